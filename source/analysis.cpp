@@ -0,0 +1,431 @@
+#include "analysis.hpp"
+#include "jit.hpp"
+#include "profile.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+// value of I on entry to a block, as far as the edges into it tell
+struct IndexState{
+    enum Kind : uint8_t{
+        // no edge into the block looked at yet
+        INDEX_UNSET,
+        // the same value on every edge
+        INDEX_KNOWN,
+        // differs between edges, or comes from something not followed (Fx1E, a routine, ...)
+        INDEX_VARIES
+    };
+    Kind kind;
+    uint16_t value;
+};
+
+// combine `from` into `to`; true if `to` changed
+static bool Meet(IndexState& to, IndexState const& from){
+    if (from.kind == IndexState::INDEX_UNSET || to.kind == IndexState::INDEX_VARIES){
+        return false;
+    }
+    if (to.kind == IndexState::INDEX_UNSET){
+        to = from;
+        return true;
+    }
+    if (from.kind == IndexState::INDEX_VARIES || from.value != to.value){
+        to.kind = IndexState::INDEX_VARIES;
+        return true;
+    }
+    return false;
+}
+
+static char const* ExitName(BlockExit exit){
+    switch (exit){
+        case EXIT_FALLTHROUGH:
+            return "fallthrough";
+        case EXIT_JUMP:
+            return "jump";
+        case EXIT_CALL:
+            return "call";
+        case EXIT_RETURN:
+            return "return";
+        case EXIT_SKIP:
+            return "skip";
+        case EXIT_INDIRECT:
+            return "indirect";
+        case EXIT_HALT:
+            return "halt";
+        default:
+            return "invalid";
+    }
+}
+
+Analysis::Analysis(Chip8 const& chip8)
+    : chip8(chip8), mask(chip8.memoryMask), bytes(chip8.MemorySize())
+    {
+    Discover();
+    Split();
+    FindWrites();
+}
+
+unsigned int Analysis::SizeAt(uint16_t address) const{
+    return chip8.decoded[address & mask].id == OPID_F000 ? 4 : 2;
+}
+
+void Analysis::Discover(){
+    std::vector<uint16_t> pending;
+    // a block starts at target and control may get there
+    auto branch = [this, &pending](uint16_t target){
+        target &= mask;
+        bytes[target] |= BYTE_LEADER;
+        pending.push_back(target);
+    };
+    branch(START_ADDRESS);
+
+    while (!pending.empty()){
+        uint16_t address = pending.back();
+        pending.pop_back();
+
+        // follow straight-line code until it was seen before or control leaves it
+        while (!(bytes[address] & BYTE_START)){
+            Instruction const& instruction = chip8.decoded[address];
+            unsigned int size = SizeAt(address);
+            uint16_t next = (address + size) & mask;
+
+            bytes[address] |= BYTE_START;
+            for (unsigned int i = 0; i < size; ++i){
+                bytes[(address + i) & mask] |= BYTE_CODE;
+            }
+            ++instructions;
+
+            // the OpIds of each instruction set are contiguous, SCHIP's before XO-CHIP's
+            if (instruction.id >= OPID_00Dn || address >= MEMORY_SIZE){
+                minimumVariant = VARIANT_XOCHIP;
+            }
+            else if (instruction.id >= OPID_00Cn && minimumVariant == VARIANT_CHIP8){
+                minimumVariant = VARIANT_SCHIP;
+            }
+
+            bool fallsThrough = true;
+            switch (instruction.id){
+                case OPID_1nnn:
+                    branch(instruction.nnn);
+                    fallsThrough = false;
+                    break;
+                case OPID_2nnn:
+                    // the routine returns to next, so it starts a block as well
+                    branch(instruction.nnn);
+                    bytes[next] |= BYTE_LEADER;
+                    break;
+                case OPID_3xkk:
+                case OPID_4xkk:
+                case OPID_5xy0:
+                case OPID_9xy0:
+                case OPID_Ex9E:
+                case OPID_ExA1:
+                    bytes[next] |= BYTE_LEADER;
+                    branch(next + SizeAt(next));
+                    break;
+                case OPID_Bnnn:
+                    ++indirectJumps;
+                    fallsThrough = false;
+                    break;
+                case OPID_NULL:
+                case OPID_00EE:
+                case OPID_00FD:
+                    fallsThrough = false;
+                    break;
+                default:
+                    break;
+            }
+            if (!fallsThrough){
+                break;
+            }
+            address = next;
+        }
+    }
+}
+
+void Analysis::Split(){
+    for (unsigned int start = 0; start <= mask; ++start){
+        if ((bytes[start] & (BYTE_START | BYTE_LEADER)) != (BYTE_START | BYTE_LEADER)){
+            continue;
+        }
+
+        BasicBlock block{};
+        block.start = start;
+        uint16_t address = start;
+
+        for (;;){
+            Instruction const& instruction = chip8.decoded[address];
+            unsigned int size = SizeAt(address);
+            uint16_t next = (address + size) & mask;
+            bool ends = true;
+            ++block.instructions;
+
+            switch (instruction.id){
+                case OPID_1nnn:
+                    if (instruction.nnn == address){
+                        block.exit = EXIT_HALT;
+                    }
+                    else{
+                        block.exit = EXIT_JUMP;
+                        block.successors.push_back(instruction.nnn & mask);
+                    }
+                    break;
+                case OPID_2nnn:
+                    block.exit = EXIT_CALL;
+                    block.successors.push_back(instruction.nnn & mask);
+                    block.successors.push_back(next);
+                    break;
+                case OPID_3xkk:
+                case OPID_4xkk:
+                case OPID_5xy0:
+                case OPID_9xy0:
+                case OPID_Ex9E:
+                case OPID_ExA1:
+                    block.exit = EXIT_SKIP;
+                    block.successors.push_back(next);
+                    block.successors.push_back((next + SizeAt(next)) & mask);
+                    break;
+                case OPID_00EE:
+                    block.exit = EXIT_RETURN;
+                    break;
+                case OPID_Bnnn:
+                    block.exit = EXIT_INDIRECT;
+                    break;
+                case OPID_00FD:
+                    block.exit = EXIT_HALT;
+                    break;
+                case OPID_NULL:
+                    block.exit = EXIT_INVALID;
+                    break;
+                default:
+                    // straight on, unless something else jumps to next or memory wraps around
+                    if ((bytes[next] & BYTE_LEADER) || next <= address){
+                        block.exit = EXIT_FALLTHROUGH;
+                        block.successors.push_back(next);
+                    }
+                    else{
+                        ends = false;
+                    }
+                    break;
+            }
+
+            if (ends){
+                block.end = address + size;
+                break;
+            }
+            address = next;
+        }
+        blocks.push_back(block);
+    }
+}
+
+int Analysis::BlockAt(uint16_t address) const{
+    // last block starting at or before address
+    auto it = std::upper_bound(blocks.begin(), blocks.end(), address,
+                               [](uint16_t value, BasicBlock const& block){ return value < block.start; });
+    if (it == blocks.begin()){
+        return -1;
+    }
+    --it;
+    return address < it->end ? (int)(it - blocks.begin()) : -1;
+}
+
+void Analysis::FindWrites(){
+    if (blocks.empty()){
+        return;
+    }
+
+    // I on entry to every block; a fresh machine starts at 0x200 with I = 0
+    std::vector<IndexState> entry(blocks.size(), IndexState{IndexState::INDEX_UNSET, 0});
+    int first = BlockAt(START_ADDRESS);
+    entry[first] = IndexState{IndexState::INDEX_KNOWN, 0};
+
+    // runs the block from state; if `record`, adds its stores to writes. Returns I at its exit.
+    auto transfer = [this](BasicBlock const& block, IndexState state, bool record){
+        uint16_t address = block.start;
+        for (unsigned int i = 0; i < block.instructions; ++i){
+            Instruction const& instruction = chip8.decoded[address];
+            uint16_t length = 0;
+
+            switch (instruction.id){
+                case OPID_Annn:
+                    state = IndexState{IndexState::INDEX_KNOWN, instruction.nnn};
+                    break;
+                case OPID_F000:
+                    state = IndexState{IndexState::INDEX_KNOWN,
+                                       (uint16_t)((chip8.memory[(address + 2) & mask] << 8u) | chip8.memory[(address + 3) & mask])};
+                    break;
+                case OPID_Fx1E:
+                case OPID_Fx29:
+                case OPID_Fx30:
+                    // depends on Vx, which is not followed
+                    state.kind = IndexState::INDEX_VARIES;
+                    break;
+                case OPID_Fx33:
+                    length = 3;
+                    break;
+                case OPID_Fx55:
+                    length = instruction.x + 1;
+                    break;
+                case OPID_5xy2:
+                    length = (instruction.x < instruction.y ? instruction.y - instruction.x : instruction.x - instruction.y) + 1;
+                    break;
+                default:
+                    break;
+            }
+
+            if (record && length > 0){
+                MemoryWrite write{};
+                write.address = address;
+                write.known = state.kind == IndexState::INDEX_KNOWN;
+                if (write.known){
+                    write.first = state.value & mask;
+                    write.length = length;
+                }
+                writes.push_back(write);
+            }
+            address = (address + SizeAt(address)) & mask;
+        }
+        return state;
+    };
+
+    // iterate to a fixed point; every entry only ever moves up from unset to known to varies
+    std::vector<int> pending(1, first);
+    while (!pending.empty()){
+        BasicBlock const& block = blocks[pending.back()];
+        IndexState state = entry[pending.back()];
+        pending.pop_back();
+
+        IndexState exit = transfer(block, state, false);
+        for (size_t i = 0; i < block.successors.size(); ++i){
+            int successor = BlockAt(block.successors[i]);
+            if (successor < 0){
+                continue;
+            }
+            // the routine may change I before it returns
+            IndexState in = block.exit == EXIT_CALL && i == 1 ? IndexState{IndexState::INDEX_VARIES, 0} : exit;
+            if (Meet(entry[successor], in)){
+                pending.push_back(successor);
+            }
+        }
+    }
+
+    for (size_t b = 0; b < blocks.size(); ++b){
+        IndexState state = entry[b];
+        // not reached from 0x200 through edges with a known I; assume nothing
+        if (state.kind == IndexState::INDEX_UNSET){
+            state.kind = IndexState::INDEX_VARIES;
+        }
+        transfer(blocks[b], state, true);
+    }
+
+    for (MemoryWrite& write : writes){
+        for (unsigned int i = 0; write.known && i < write.length; ++i){
+            uint16_t address = (write.first + i) & mask;
+            if (bytes[address] & BYTE_CODE){
+                write.hitsCode = true;
+                int block = BlockAt(address);
+                if (block >= 0){
+                    blocks[block].written = true;
+                }
+            }
+        }
+    }
+}
+
+unsigned int Analysis::UnknownWrites() const{
+    unsigned int count = 0;
+    for (MemoryWrite const& write : writes){
+        if (!write.known){
+            ++count;
+        }
+    }
+    return count;
+}
+
+bool Analysis::SelfModifying() const{
+    for (MemoryWrite const& write : writes){
+        if (write.hitsCode){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Analysis::Listing(char const* filename) const{
+    std::ofstream file(filename);
+    if (!file){
+        return false;
+    }
+
+    size_t nextWrite = 0;
+    char line[96];
+    for (BasicBlock const& block : blocks){
+        std::snprintf(line, sizeof(line), "block %03x-%03x %s%s", block.start, block.end - 1, ExitName(block.exit),
+                      block.written ? " written" : "");
+        file << line;
+        for (size_t i = 0; i < block.successors.size(); ++i){
+            std::snprintf(line, sizeof(line), "%s%03x", i == 0 ? " -> " : " ", block.successors[i]);
+            file << line;
+        }
+        file << std::endl;
+
+        uint16_t address = block.start;
+        for (unsigned int i = 0; i < block.instructions; ++i){
+            uint8_t id = chip8.decoded[address].id;
+            unsigned int opcode = (chip8.memory[address] << 8u) | chip8.memory[(address + 1) & mask];
+            std::snprintf(line, sizeof(line), "  %03x %04x %s", address, opcode, Profile::OpName(id));
+            file << line;
+            if (id == OPID_F000){
+                std::snprintf(line, sizeof(line), " %02x%02x", chip8.memory[(address + 2) & mask], chip8.memory[(address + 3) & mask]);
+                file << line;
+            }
+
+            // writes are in block order, so the one for this instruction, if any, is next
+            while (nextWrite < writes.size() && writes[nextWrite].address == address){
+                MemoryWrite const& write = writes[nextWrite++];
+                if (write.known){
+                    std::snprintf(line, sizeof(line), " ; writes %03x-%03x%s", write.first, write.first + write.length - 1,
+                                  write.hitsCode ? " over code" : "");
+                }
+                else{
+                    std::snprintf(line, sizeof(line), " ; writes at unknown I");
+                }
+                file << line;
+            }
+            file << std::endl;
+            address = (address + SizeAt(address)) & mask;
+        }
+    }
+    return (bool)file;
+}
+
+bool Analysis::Dot(char const* filename) const{
+    std::ofstream file(filename);
+    if (!file){
+        return false;
+    }
+
+    char line[128];
+    file << "digraph cfg {" << std::endl;
+    file << "    node [shape=box fontname=monospace];" << std::endl;
+    for (BasicBlock const& block : blocks){
+        std::snprintf(line, sizeof(line), "    b%03x [label=\"%03x-%03x\\n%u instructions\\n%s\"%s];", block.start, block.start,
+                      block.end - 1, block.instructions, ExitName(block.exit), block.written ? " color=red" : "");
+        file << line << std::endl;
+        for (size_t i = 0; i < block.successors.size(); ++i){
+            // the return site of a call is reached through the routine
+            bool returnSite = block.exit == EXIT_CALL && i == 1;
+            std::snprintf(line, sizeof(line), "    b%03x -> b%03x%s;", block.start, block.successors[i], returnSite ? " [style=dashed]" : "");
+            file << line << std::endl;
+        }
+    }
+    file << "}" << std::endl;
+    return (bool)file;
+}
+
+void Chip8::Pretranslate(Analysis const& analysis){
+    // the table and threaded engines work off `decoded`, which LoadROM already filled in
+    if (engine == ENGINE_JIT && jit){
+        jit->Prepare(analysis);
+    }
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "chip8.hpp"
+
+// how control leaves a basic block
+enum BlockExit : uint8_t{
+    // runs into the next block, which something else jumps to
+    EXIT_FALLTHROUGH,
+    // 1nnn
+    EXIT_JUMP,
+    // 2nnn; successors are the routine and the instruction after the call
+    EXIT_CALL,
+    // 00EE
+    EXIT_RETURN,
+    // 3xkk, 4xkk, 5xy0, 9xy0, Ex9E, ExA1; successors are the next instruction and the one after it
+    EXIT_SKIP,
+    // Bnnn; the target depends on V0, so there are no known successors
+    EXIT_INDIRECT,
+    // 1nnn to itself or SCHIP's 00FD
+    EXIT_HALT,
+    // an opcode the variant does not have; most likely data, so it is not followed
+    EXIT_INVALID
+};
+
+struct BasicBlock{
+    uint16_t start;
+    // first byte after the last instruction; up to XO_MEMORY_SIZE
+    unsigned int end;
+    uint16_t instructions;
+    BlockExit exit;
+    // true if a store whose address is known writes into the block
+    bool written;
+    // start addresses of the blocks control can go to next
+    std::vector<uint16_t> successors;
+};
+
+// one Fx33, Fx55 or 5xy2 in reachable code
+struct MemoryWrite{
+    // address of the storing instruction
+    uint16_t address;
+    // bytes written, if I is the same every time the instruction runs
+    uint16_t first;
+    uint16_t length;
+    bool known;
+    // true if a written byte belongs to a reachable instruction
+    bool hitsCode;
+};
+
+/*
+ * Static control-flow analysis of the program in a Chip8's memory, done once
+ * after LoadROM without running anything.
+ *
+ * Starting at 0x200, every instruction that a jump, call, return site or skip
+ * can reach is followed (the decode tables of the Chip8's variant decide what
+ * each opcode is), and the reachable code is split into basic blocks at every
+ * branch target. The value of I is then propagated along the edges, so Fx33,
+ * Fx55 and 5xy2 stores whose address is the same on every path can be checked
+ * against the code they might overwrite. Bnnn targets are not guessed.
+ *
+ * The engines use it to do their per-block work before the first frame
+ * (see Chip8::Pretranslate).
+ */
+class Analysis{
+    public:
+        explicit Analysis(Chip8 const& chip8);
+
+        // ordered by start address
+        std::vector<BasicBlock> const& Blocks() const { return blocks; }
+        std::vector<MemoryWrite> const& Writes() const { return writes; }
+        // index into Blocks() of the block holding the instruction at address, or -1
+        int BlockAt(uint16_t address) const;
+        // true if a reachable instruction starts at address
+        bool IsInstruction(uint16_t address) const { return (bytes[address & mask] & BYTE_START) != 0; }
+
+        unsigned int Instructions() const { return instructions; }
+        // Bnnn jumps reached
+        unsigned int IndirectJumps() const { return indirectJumps; }
+        // stores whose address could not be worked out
+        unsigned int UnknownWrites() const;
+        // true if a store with a known address writes over reachable code
+        bool SelfModifying() const;
+        // smallest instruction set that has every reachable instruction
+        Variant MinimumVariant() const { return minimumVariant; }
+
+        // every block with its instructions, exit and successors
+        bool Listing(char const* filename) const;
+        // the control-flow graph in Graphviz dot format
+        bool Dot(char const* filename) const;
+
+    private:
+        enum ByteFlag : uint8_t{
+            // a reachable instruction starts here
+            BYTE_START = 1,
+            // part of a reachable instruction
+            BYTE_CODE = 2,
+            // first instruction of a basic block
+            BYTE_LEADER = 4
+        };
+
+        Chip8 const& chip8;
+        uint16_t mask;
+        // ByteFlags of every byte of memory
+        std::vector<uint8_t> bytes;
+        std::vector<BasicBlock> blocks;
+        std::vector<MemoryWrite> writes;
+        unsigned int instructions{};
+        unsigned int indirectJumps{};
+        Variant minimumVariant{VARIANT_CHIP8};
+
+        // bytes taken by the instruction at address: 4 for XO-CHIP's F000 nnnn
+        unsigned int SizeAt(uint16_t address) const;
+        // mark everything reachable from 0x200
+        void Discover();
+        // cut the reachable code into blocks at the leaders
+        void Split();
+        // propagate I through the blocks and record the stores
+        void FindWrites();
+
+        Analysis(Analysis const&);
+        Analysis& operator=(Analysis const&);
+};
@@ -0,0 +1,90 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "analysis.hpp"
+#include "chip8.hpp"
+
+// Disassembles a ROM without running it and reports its control-flow graph: basic
+// blocks, unresolved Bnnn jumps, stores that write over code, and the smallest
+// instruction set the reachable code needs.
+
+static void usage(char const* name){
+    std::cerr << "Usage: " << name << " [--variant chip8|schip|xochip|auto] [--listing FILE] [--dot FILE] <ROM>" << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv){
+    char const* romName = nullptr;
+    // decode tables to disassemble with
+    Variant variant = VARIANT_CHIP8;
+    // disassemble with XO-CHIP's tables, the widest, and report what the ROM actually needs
+    bool autoVariant = false;
+    // files the block listing and the Graphviz graph are written to, if any
+    char const* listingName = nullptr;
+    char const* dotName = nullptr;
+
+    for (int i = 1; i < argc; ++i){
+        if (std::strcmp(argv[i], "--variant") == 0 && i + 1 < argc){
+            ++i;
+            if (std::strcmp(argv[i], "auto") == 0){
+                autoVariant = true;
+                variant = VARIANT_XOCHIP;
+            }
+            else if (!Chip8::VariantFromName(argv[i], variant)){
+                usage(argv[0]);
+            }
+        }
+        else if (std::strcmp(argv[i], "--listing") == 0 && i + 1 < argc){
+            listingName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--dot") == 0 && i + 1 < argc){
+            dotName = argv[++i];
+        }
+        else if (argv[i][0] == '-'){
+            usage(argv[0]);
+        }
+        else{
+            romName = argv[i];
+        }
+    }
+    if (romName == nullptr){
+        usage(argv[0]);
+    }
+
+    Chip8 chip8(1);
+    chip8.SetVariant(variant);
+    if (!chip8.LoadROM(romName)){
+        std::cerr << "Could not open ROM " << romName << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    Analysis analysis(chip8);
+    auto endTime = std::chrono::high_resolution_clock::now();
+
+    unsigned int written = 0;
+    unsigned int intoCode = 0;
+    for (MemoryWrite const& write : analysis.Writes()){
+        written += write.known ? 1 : 0;
+        intoCode += write.hitsCode ? 1 : 0;
+    }
+
+    std::cout << "variant: " << (autoVariant ? "auto" : Chip8::VariantName(variant)) << std::endl;
+    std::cout << "minimum variant: " << Chip8::VariantName(analysis.MinimumVariant()) << std::endl;
+    std::cout << "instructions: " << analysis.Instructions() << std::endl;
+    std::cout << "blocks: " << analysis.Blocks().size() << std::endl;
+    std::cout << "indirect jumps: " << analysis.IndirectJumps() << std::endl;
+    std::cout << "stores: " << analysis.Writes().size() << " (" << written << " known, " << intoCode << " over code, "
+              << analysis.UnknownWrites() << " unknown)" << std::endl;
+    std::cout << "self-modifying: " << (analysis.SelfModifying() ? "yes" : "no") << std::endl;
+    std::cout << "seconds: " << std::chrono::duration<double>(endTime - startTime).count() << std::endl;
+
+    if (listingName != nullptr && !analysis.Listing(listingName)){
+        std::cerr << "Could not write listing " << listingName << std::endl;
+    }
+    if (dotName != nullptr && !analysis.Dot(dotName)){
+        std::cerr << "Could not write graph " << dotName << std::endl;
+    }
+    return 0;
+}
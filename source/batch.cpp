@@ -0,0 +1,139 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "batchrunner.hpp"
+#include "chip8.hpp"
+#include "scheduler.hpp"
+#include "threadpool.hpp"
+
+// emulated instructions per second unless --ips is given
+const unsigned int DEFAULT_IPS = 700;
+// frames a job runs before going back to the pool unless --slice is given
+const unsigned int DEFAULT_SLICE_FRAMES = 60;
+// Cxkk seed of the first copy of every ROM unless --seed is given
+const uint64_t DEFAULT_SEED = 1;
+
+// Runs many ROMs (or many copies of them) headless on every core and prints one
+// line per job: ROM, display hash, instructions, frames and why it stopped.
+
+static void usage(char const* name){
+    std::cerr << "Usage: " << name << " [--threads N] [--cycles N] [--ips N] [--engine table|threaded|jit] [--slice FRAMES] [--repeat N] [--lanes N] [--seed N] <ROM>..." << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv){
+    // 0 means one worker per hardware thread
+    unsigned int threads = 0;
+    // number of instructions every job executes unless it halts first
+    unsigned long long cycles = 10000000ULL;
+    unsigned int ips = DEFAULT_IPS;
+    Engine engine = ENGINE_TABLE;
+    unsigned int sliceFrames = DEFAULT_SLICE_FRAMES;
+    // jobs per ROM
+    unsigned int repeat = 1;
+    // copies of a ROM run together by one Lockstep; 1 runs every job on its own Chip8
+    unsigned int lanes = 1;
+    // copy r of every ROM is seeded with seed + r
+    uint64_t seed = DEFAULT_SEED;
+    std::vector<char const*> romNames;
+
+    for (int i = 1; i < argc; ++i){
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+            threads = std::stoul(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--cycles") == 0 && i + 1 < argc){
+            cycles = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--ips") == 0 && i + 1 < argc){
+            ips = std::stoul(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc){
+            if (!Chip8::EngineFromName(argv[++i], engine)){
+                usage(argv[0]);
+            }
+        }
+        else if (std::strcmp(argv[i], "--slice") == 0 && i + 1 < argc){
+            sliceFrames = std::stoul(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc){
+            repeat = std::stoul(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--lanes") == 0 && i + 1 < argc){
+            lanes = std::stoul(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+            seed = std::stoull(argv[++i]);
+        }
+        else if (argv[i][0] == '-'){
+            usage(argv[0]);
+        }
+        else{
+            romNames.push_back(argv[i]);
+        }
+    }
+
+    if (romNames.empty() || ips < TIMER_HZ){
+        usage(argv[0]);
+    }
+
+    // every ROM is read once and shared by all of its jobs
+    std::vector<std::vector<uint8_t>> roms(romNames.size());
+    for (size_t i = 0; i < romNames.size(); ++i){
+        std::ifstream file(romNames[i], std::ios::binary);
+        if (!file.is_open()){
+            std::cerr << "Could not open ROM " << romNames[i] << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        roms[i].assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    std::vector<BatchJob> jobs;
+    // jobNames[i] is the ROM of jobs[i]
+    std::vector<char const*> jobNames;
+    for (size_t i = 0; i < roms.size(); ++i){
+        for (unsigned int r = 0; r < repeat; ++r){
+            BatchJob job;
+            job.rom = roms[i].data();
+            job.romSize = roms[i].size();
+            job.engine = engine;
+            job.instructionsPerSecond = ips;
+            job.instructions = cycles;
+            job.seed = seed + r;
+            jobs.push_back(job);
+            jobNames.push_back(romNames[i]);
+        }
+    }
+
+    ThreadPool pool(threads);
+    BatchRunner runner(pool, sliceFrames, lanes);
+    std::vector<BatchResult> results;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    runner.Run(jobs, results);
+    auto endTime = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+    unsigned long long total = 0;
+    for (size_t i = 0; i < results.size(); ++i){
+        BatchResult const& result = results[i];
+        std::cout << jobNames[i] << ' ' << std::hex << result.videoHash << std::dec
+                  << ' ' << result.instructions << ' ' << result.frames
+                  << ' ' << BatchRunner::ExitReasonName(result.exitReason) << '\n';
+        total += result.instructions;
+    }
+    std::cout.flush();
+
+    std::cerr << "engine: " << (lanes > 1 ? "lockstep" : Chip8::EngineName(engine)) << std::endl;
+    std::cerr << "threads: " << pool.Threads() << std::endl;
+    std::cerr << "jobs: " << jobs.size() << std::endl;
+    std::cerr << "instructions: " << total << std::endl;
+    std::cerr << "seconds: " << seconds << std::endl;
+    std::cerr << "instructions/second: " << (seconds > 0 ? total / seconds : 0) << std::endl;
+    return 0;
+}
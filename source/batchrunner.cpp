@@ -0,0 +1,196 @@
+#include "batchrunner.hpp"
+#include "lockstep.hpp"
+#include "scheduler.hpp"
+#include "threadpool.hpp"
+#include <memory>
+
+// State of one job between slices
+struct BatchRunner::Context{
+    BatchJob const* job;
+    BatchResult* result;
+    std::unique_ptr<Chip8> chip8;
+    std::unique_ptr<Scheduler> scheduler;
+    uint64_t executed;
+};
+
+// State of a group of jobs run by one Lockstep; lane i belongs to jobs[first + i]
+struct BatchRunner::LockstepContext{
+    std::vector<BatchJob> const* jobs;
+    std::vector<BatchResult>* results;
+    size_t first;
+    unsigned int count;
+    std::unique_ptr<Lockstep> lockstep;
+    std::unique_ptr<Scheduler> scheduler;
+    uint64_t executed;
+    // finished[i] is set once lane i halted and its result was written
+    std::vector<bool> finished;
+    unsigned int running;
+};
+
+// true if a and b can share a Lockstep
+static bool SameProgram(BatchJob const& a, BatchJob const& b){
+    return a.rom == b.rom && a.romSize == b.romSize
+        && a.instructionsPerSecond == b.instructionsPerSecond && a.instructions == b.instructions;
+}
+
+BatchRunner::BatchRunner(ThreadPool& pool, unsigned int sliceFrames, unsigned int lanes)
+    : pool(pool),
+      sliceFrames(sliceFrames > 0 ? sliceFrames : 1),
+      lanes(lanes > 0 ? lanes : 1)
+    {
+}
+
+void BatchRunner::Run(std::vector<BatchJob> const& jobs, std::vector<BatchResult>& results){
+    results.assign(jobs.size(), BatchResult());
+
+    if (lanes > 1){
+        size_t i = 0;
+        while (i < jobs.size()){
+            LockstepContext* context = new LockstepContext();
+            context->jobs = &jobs;
+            context->results = &results;
+            context->first = i;
+            context->count = 1;
+            while (context->count < lanes && i + context->count < jobs.size()
+                   && SameProgram(jobs[i], jobs[i + context->count])){
+                ++context->count;
+            }
+            context->executed = 0;
+            i += context->count;
+            pool.Submit([this, context]{ RunLockstepSlice(context); });
+        }
+        pool.Wait();
+        return;
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i){
+        Context* context = new Context();
+        context->job = &jobs[i];
+        context->result = &results[i];
+        context->executed = 0;
+        pool.Submit([this, context]{ RunSlice(context); });
+    }
+    pool.Wait();
+}
+
+void BatchRunner::RunSlice(Context* context){
+    BatchJob const& job = *context->job;
+    BatchResult& result = *context->result;
+
+    if (!context->chip8){
+        context->chip8.reset(new Chip8(job.seed));
+        if (!context->chip8->LoadROM(job.rom, job.romSize)){
+            result.exitReason = EXIT_BAD_ROM;
+            delete context;
+            return;
+        }
+        context->chip8->SetEngine(job.engine);
+        context->scheduler.reset(new Scheduler(job.instructionsPerSecond));
+    }
+
+    Chip8& chip8 = *context->chip8;
+    Scheduler& scheduler = *context->scheduler;
+
+    // EXIT_BUDGET while still running
+    ExitReason reason = EXIT_BUDGET;
+    for (unsigned int frame = 0; frame < sliceFrames && context->executed < job.instructions; ++frame){
+        context->executed += scheduler.RunFrame(chip8);
+        if (chip8.Halted()){
+            reason = EXIT_HALTED;
+            break;
+        }
+        if (chip8.Blocked()){
+            reason = EXIT_BLOCKED;
+            break;
+        }
+    }
+
+    if (reason == EXIT_BUDGET && context->executed < job.instructions){
+        pool.Submit([this, context]{ RunSlice(context); });
+        return;
+    }
+
+    result.videoHash = chip8.VideoHash();
+    result.instructions = context->executed;
+    result.frames = scheduler.Frames();
+    result.exitReason = reason;
+    delete context;
+}
+
+void BatchRunner::RunLockstepSlice(LockstepContext* context){
+    BatchJob const& job = (*context->jobs)[context->first];
+    BatchResult* results = &(*context->results)[context->first];
+
+    if (!context->lockstep){
+        context->lockstep.reset(new Lockstep(context->count));
+        if (!context->lockstep->LoadROM(job.rom, job.romSize)){
+            for (unsigned int lane = 0; lane < context->count; ++lane){
+                results[lane].exitReason = EXIT_BAD_ROM;
+            }
+            delete context;
+            return;
+        }
+        for (unsigned int lane = 0; lane < context->count; ++lane){
+            context->lockstep->Seed(lane, (*context->jobs)[context->first + lane].seed);
+        }
+        context->scheduler.reset(new Scheduler(job.instructionsPerSecond));
+        context->finished.assign(context->count, false);
+        context->running = context->count;
+    }
+
+    Lockstep& lockstep = *context->lockstep;
+    Scheduler& scheduler = *context->scheduler;
+
+    for (unsigned int frame = 0; frame < sliceFrames && context->executed < job.instructions && context->running > 0; ++frame){
+        unsigned int budget = scheduler.NextFrame();
+        lockstep.Run(budget);
+        lockstep.TickTimers();
+        context->executed += budget;
+
+        // a halted or blocked lane gets the result it would have had on its own; it
+        // keeps spinning on its jump or Fx0A until the others are done
+        for (unsigned int lane = 0; lane < context->count; ++lane){
+            if (context->finished[lane]){
+                continue;
+            }
+            bool halted = lockstep.Halted(lane);
+            if (halted || lockstep.Blocked(lane)){
+                results[lane].videoHash = lockstep.VideoHash(lane);
+                results[lane].instructions = context->executed;
+                results[lane].frames = scheduler.Frames();
+                results[lane].exitReason = halted ? EXIT_HALTED : EXIT_BLOCKED;
+                context->finished[lane] = true;
+                --context->running;
+            }
+        }
+    }
+
+    if (context->executed < job.instructions && context->running > 0){
+        pool.Submit([this, context]{ RunLockstepSlice(context); });
+        return;
+    }
+
+    for (unsigned int lane = 0; lane < context->count; ++lane){
+        if (!context->finished[lane]){
+            results[lane].videoHash = lockstep.VideoHash(lane);
+            results[lane].instructions = context->executed;
+            results[lane].frames = scheduler.Frames();
+            results[lane].exitReason = EXIT_BUDGET;
+        }
+    }
+    delete context;
+}
+
+char const* BatchRunner::ExitReasonName(ExitReason reason){
+    switch (reason){
+        case EXIT_HALTED:
+            return "halted";
+        case EXIT_BLOCKED:
+            return "blocked";
+        case EXIT_BAD_ROM:
+            return "bad-rom";
+        case EXIT_BUDGET:
+        default:
+            return "budget";
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "chip8.hpp"
+
+class ThreadPool;
+
+// Why a batch job stopped
+enum ExitReason{
+    // ran its instruction budget
+    EXIT_BUDGET,
+    // hit a jump to itself (see Chip8::Halted)
+    EXIT_HALTED,
+    // waiting in Fx0A for a key, which never comes in a batch (see Chip8::Blocked)
+    EXIT_BLOCKED,
+    // the ROM image did not fit into memory
+    EXIT_BAD_ROM
+};
+
+// One machine to run. rom is not copied and has to outlive BatchRunner::Run.
+struct BatchJob{
+    uint8_t const* rom;
+    size_t romSize;
+    Engine engine;
+    // emulated speed; decides how many instructions run between timer ticks
+    unsigned int instructionsPerSecond;
+    // stop once this many instructions ran (rounded up to a whole frame)
+    uint64_t instructions;
+    // Cxkk seed; the same job with the same seed gives the same result
+    uint64_t seed;
+};
+
+struct BatchResult{
+    // Chip8::VideoHash of the final display
+    uint64_t videoHash;
+    uint64_t instructions;
+    uint64_t frames;
+    ExitReason exitReason;
+};
+
+/*
+ * Runs many independent Chip8 instances on a ThreadPool. Each job advances
+ * `sliceFrames` frames per task and then resubmits itself, so a job never
+ * holds a core for long and idle workers can steal the remaining slices.
+ * A machine is only allocated when its first slice runs, on the thread that
+ * runs it, and freed as soon as the job finishes.
+ *
+ * With lanes > 1, neighbouring jobs of the same ROM, speed and budget are packed
+ * into one Lockstep of up to `lanes` machines instead, and their engine is ignored.
+ */
+class BatchRunner{
+    public:
+        BatchRunner(ThreadPool& pool, unsigned int sliceFrames, unsigned int lanes = 1);
+
+        // run every job; results[i] belongs to jobs[i]. Blocks until all are done.
+        void Run(std::vector<BatchJob> const& jobs, std::vector<BatchResult>& results);
+
+        static char const* ExitReasonName(ExitReason reason);
+
+    private:
+        struct Context;
+        struct LockstepContext;
+
+        ThreadPool& pool;
+        unsigned int sliceFrames;
+        unsigned int lanes;
+
+        // run one slice of the job and resubmit it if it is not finished
+        void RunSlice(Context* context);
+        // same for a group of jobs sharing a Lockstep
+        void RunLockstepSlice(LockstepContext* context);
+};
@@ -0,0 +1,270 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "chip8.hpp"
+
+// Measures ns per instruction for every opcode on every engine, plus the decode
+// tables alone, Dxyn across sprite heights and positions, and the SUPER-CHIP and
+// XO-CHIP scrolls and 16x16 sprites, and prints JSON.
+//
+// Each case is a short prelude that sets up registers, then a block of
+// BLOCK_LENGTH copies of the opcode under test and a jump back to the block,
+// so the jump is 1 in BLOCK_LENGTH + 1 of the instructions measured.
+
+// copies of the measured opcode between two jumps back
+const unsigned int BLOCK_LENGTH = 256;
+// instructions per measurement unless --iterations is given
+const unsigned int DEFAULT_ITERATIONS = 1000000;
+// measurements per case; the fastest is reported
+const unsigned int REPEATS = 3;
+// where Fx33/Fx55/Fx65 point I, well past the code
+const uint16_t DATA_ADDRESS = 0xE00;
+// target of 2nnn; holds a 00EE
+const uint16_t SUBROUTINE_ADDRESS = 0xD00;
+
+struct BenchCase{
+    std::string name;
+    // runs once before the block
+    std::vector<uint16_t> prelude;
+    // opcode to place at `address` in the block
+    std::function<uint16_t(uint16_t address)> opcode;
+    // instruction set the case runs under; CHIP-8 unless given
+    Variant variant;
+};
+
+static void usage(char const* name){
+    std::cerr << "Usage: " << name << " [--iterations N] [--engine table|threaded|jit] [--filter TEXT]" << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+// same opcode at every address
+static std::function<uint16_t(uint16_t)> Fixed(uint16_t opcode){
+    return [opcode](uint16_t){ return opcode; };
+}
+
+static std::vector<BenchCase> MakeCases(){
+    std::vector<BenchCase> cases;
+    // V0 = 0x12, V1 = 0x34, I = DATA_ADDRESS
+    std::vector<uint16_t> registers = { 0x6012, 0x6134, (uint16_t)(0xA000 | DATA_ADDRESS) };
+
+    cases.push_back({ "NULL", {}, Fixed(0x0000) });
+    cases.push_back({ "00E0", {}, Fixed(0x00E0) });
+    cases.push_back({ "1nnn", {}, [](uint16_t address){ return (uint16_t)(0x1000 | (address + 2)); } });
+    // a call and its return; both count as instructions
+    cases.push_back({ "2nnn+00EE", {}, Fixed(0x2000 | SUBROUTINE_ADDRESS) });
+    // skips are measured not taken, so every copy runs
+    cases.push_back({ "3xkk", registers, Fixed(0x3000) });
+    cases.push_back({ "4xkk", registers, Fixed(0x4012) });
+    cases.push_back({ "5xy0", registers, Fixed(0x5010) });
+    cases.push_back({ "6xkk", registers, Fixed(0x6256) });
+    cases.push_back({ "7xkk", registers, Fixed(0x7203) });
+    cases.push_back({ "8xy0", registers, Fixed(0x8200) });
+    cases.push_back({ "8xy1", registers, Fixed(0x8201) });
+    cases.push_back({ "8xy2", registers, Fixed(0x8202) });
+    cases.push_back({ "8xy3", registers, Fixed(0x8203) });
+    cases.push_back({ "8xy4", registers, Fixed(0x8014) });
+    cases.push_back({ "8xy5", registers, Fixed(0x8015) });
+    cases.push_back({ "8xy6", registers, Fixed(0x8016) });
+    cases.push_back({ "8xy7", registers, Fixed(0x8017) });
+    cases.push_back({ "8xyE", registers, Fixed(0x801E) });
+    cases.push_back({ "9xy0", registers, Fixed(0x9000) });
+    cases.push_back({ "Annn", registers, Fixed(0xA000 | DATA_ADDRESS) });
+    cases.push_back({ "Bnnn", { 0x6000 }, [](uint16_t address){ return (uint16_t)(0xB000 | (address + 2)); } });
+    cases.push_back({ "Cxkk", registers, Fixed(0xC2FF) });
+    // key 0 is held (see Measure): Ex9E tests key 1 and ExA1 key 0, so neither skips
+    cases.push_back({ "Ex9E", { 0x6101 }, Fixed(0xE19E) });
+    cases.push_back({ "ExA1", { 0x6100 }, Fixed(0xE1A1) });
+    cases.push_back({ "Fx07", registers, Fixed(0xF207) });
+    // key 0 is held (see Measure), so Fx0A never waits
+    cases.push_back({ "Fx0A", registers, Fixed(0xF20A) });
+    cases.push_back({ "Fx15", registers, Fixed(0xF015) });
+    cases.push_back({ "Fx18", registers, Fixed(0xF018) });
+    cases.push_back({ "Fx1E", { 0x6000 }, Fixed(0xF01E) });
+    cases.push_back({ "Fx29", registers, Fixed(0xF029) });
+    cases.push_back({ "Fx33", registers, Fixed(0xF033) });
+    cases.push_back({ "Fx55", registers, Fixed(0xF355) });
+    cases.push_back({ "Fx65", registers, Fixed(0xF365) });
+
+    // SUPER-CHIP and XO-CHIP scrolls and 16x16 sprites, in both resolutions (00FF switches to hi-res)
+    char const* const resolutions[] = { "lores", "hires" };
+    for (unsigned int hires = 0; hires < 2; ++hires){
+        std::vector<uint16_t> prelude;
+        if (hires){
+            prelude.push_back(0x00FF);
+        }
+        std::string suffix = std::string("/") + resolutions[hires];
+        cases.push_back({ "00Cn" + suffix, prelude, Fixed(0x00C4), VARIANT_SCHIP });
+        cases.push_back({ "00FB" + suffix, prelude, Fixed(0x00FB), VARIANT_SCHIP });
+        cases.push_back({ "00FC" + suffix, prelude, Fixed(0x00FC), VARIANT_SCHIP });
+        cases.push_back({ "00Dn" + suffix, prelude, Fixed(0x00D4), VARIANT_XOCHIP });
+        // both planes selected, so every scroll moves two
+        prelude.push_back(0xF301);
+        cases.push_back({ "00Cn/planes" + suffix, prelude, Fixed(0x00C4), VARIANT_XOCHIP });
+
+        prelude.pop_back();
+        prelude.push_back(0x600D);
+        prelude.push_back(0x6104);
+        prelude.push_back(0xA000 | DATA_ADDRESS);
+        cases.push_back({ "Dxy0" + suffix, prelude, Fixed(0xD010), VARIANT_SCHIP });
+    }
+
+    // Dxyn draws the same sprite twice per pair of copies, so the screen stays bounded.
+    // Positions: byte-aligned column, column inside a byte, clipped at the bottom right,
+    // and a start position past the edge that wraps around.
+    struct Position{
+        char const* name;
+        uint8_t x;
+        uint8_t y;
+    };
+    Position positions[] = { { "aligned", 8, 4 }, { "unaligned", 13, 4 }, { "clipped", 60, 28 }, { "wrapped", 70, 36 } };
+    for (Position const& position : positions){
+        for (unsigned int height = 1; height <= 15; ++height){
+            std::vector<uint16_t> prelude = { (uint16_t)(0x6000 | position.x), (uint16_t)(0x6100 | position.y),
+                                              (uint16_t)(0xA000 | FONTSET_START_ADDRESS) };
+            cases.push_back({ "Dxyn/h" + std::to_string(height) + "/" + position.name, prelude, Fixed(0xD010 | height) });
+        }
+    }
+    return cases;
+}
+
+static void Store(std::vector<uint8_t>& memory, uint16_t address, uint16_t opcode){
+    memory[address - START_ADDRESS] = opcode >> 8u;
+    memory[address - START_ADDRESS + 1] = opcode & 0xFFu;
+}
+
+// ROM image for a case, loaded at START_ADDRESS
+static std::vector<uint8_t> Build(BenchCase const& benchCase){
+    std::vector<uint8_t> rom(MEMORY_SIZE - START_ADDRESS);
+
+    uint16_t address = START_ADDRESS;
+    for (uint16_t opcode : benchCase.prelude){
+        Store(rom, address, opcode);
+        address += 2;
+    }
+    uint16_t block = address;
+    for (unsigned int i = 0; i < BLOCK_LENGTH; ++i){
+        Store(rom, address, benchCase.opcode(address));
+        address += 2;
+    }
+    Store(rom, address, 0x1000 | block);
+
+    // 00EE for the 2nnn case
+    Store(rom, SUBROUTINE_ADDRESS, 0x00EE);
+    return rom;
+}
+
+// best ns per instruction of REPEATS runs of `iterations` instructions
+static double Measure(BenchCase const& benchCase, Engine engine, unsigned int iterations){
+    std::vector<uint8_t> rom = Build(benchCase);
+    double best = 0;
+
+    for (unsigned int repeat = 0; repeat < REPEATS; ++repeat){
+        Chip8 chip8(1);
+        chip8.SetVariant(benchCase.variant);
+        chip8.LoadROM(rom.data(), rom.size());
+        chip8.keypad[0] = 1;
+        chip8.SetEngine(engine);
+        // time every instruction, even where a block happens to be an idle loop
+        chip8.SetIdleSkip(false);
+        // prelude, JIT translation and cache warm-up
+        chip8.Run(benchCase.prelude.size() + 4 * (BLOCK_LENGTH + 1));
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        chip8.Run(iterations);
+        auto endTime = std::chrono::high_resolution_clock::now();
+
+        double ns = std::chrono::duration<double, std::nano>(endTime - startTime).count() / iterations;
+        if (repeat == 0 || ns < best){
+            best = ns;
+        }
+    }
+    return best;
+}
+
+// ns per Chip8::Decode of the case's opcode: the table/table0/table8/tableE/tableF lookups
+// that Predecode does for every byte of memory that changes
+static double MeasureDecode(BenchCase const& benchCase, unsigned int iterations){
+    Chip8 chip8(1);
+    chip8.SetVariant(benchCase.variant);
+    uint16_t opcode = benchCase.opcode(START_ADDRESS);
+    // keeps the compiler from dropping the loop
+    volatile uint8_t sink = 0;
+    double best = 0;
+
+    for (unsigned int repeat = 0; repeat < REPEATS; ++repeat){
+        auto startTime = std::chrono::high_resolution_clock::now();
+        for (unsigned int i = 0; i < iterations; ++i){
+            // vary the operands so the lookups cannot be hoisted out of the loop
+            Instruction instruction = chip8.Decode(opcode ^ (i & 0x0F00u));
+            sink = sink + instruction.id;
+        }
+        auto endTime = std::chrono::high_resolution_clock::now();
+
+        double ns = std::chrono::duration<double, std::nano>(endTime - startTime).count() / iterations;
+        if (repeat == 0 || ns < best){
+            best = ns;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char** argv){
+    unsigned int iterations = DEFAULT_ITERATIONS;
+    std::vector<Engine> engines = { ENGINE_TABLE, ENGINE_THREADED, ENGINE_JIT };
+    // only cases whose name contains this
+    char const* filter = "";
+
+    for (int i = 1; i < argc; ++i){
+        if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc){
+            iterations = std::stoul(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc){
+            Engine engine;
+            if (!Chip8::EngineFromName(argv[++i], engine)){
+                usage(argv[0]);
+            }
+            engines.assign(1, engine);
+        }
+        else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc){
+            filter = argv[++i];
+        }
+        else{
+            usage(argv[0]);
+        }
+    }
+    if (iterations == 0){
+        usage(argv[0]);
+    }
+
+    std::vector<BenchCase> cases = MakeCases();
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "{\n";
+    std::cout << "  \"iterations\": " << iterations << ",\n";
+    std::cout << "  \"block_length\": " << BLOCK_LENGTH << ",\n";
+    std::cout << "  \"results\": [";
+
+    bool first = true;
+    for (BenchCase const& benchCase : cases){
+        if (benchCase.name.find(filter) == std::string::npos){
+            continue;
+        }
+
+        std::cout << (first ? "\n" : ",\n");
+        first = false;
+        std::cout << "    {\"case\": \"" << benchCase.name << "\"";
+        std::cout << ", \"decode_ns\": " << MeasureDecode(benchCase, iterations);
+        for (Engine engine : engines){
+            std::cout << ", \"" << Chip8::EngineName(engine) << "_ns\": " << Measure(benchCase, engine, iterations);
+        }
+        std::cout << "}";
+        std::cout.flush();
+    }
+    std::cout << "\n  ]\n}" << std::endl;
+    return 0;
+}
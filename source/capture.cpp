@@ -0,0 +1,329 @@
+#include "capture.hpp"
+#include "scheduler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+// GIF palette, in the order ExpandVideo uses: off, plane 0, plane 1, both
+static uint8_t const GIF_PALETTE[4][3] = { { 0x00, 0x00, 0x00 }, { 0xFF, 0xFF, 0xFF }, { 0xAA, 0xAA, 0xAA }, { 0x55, 0x55, 0x55 } };
+// bits per pixel of the palette indices; also LZW's minimum code size
+const unsigned int GIF_COLOR_BITS = 2;
+// LZW codes are at most 12 bits
+const unsigned int GIF_MAX_CODE = 4095;
+
+// pixel (x, y) of plane p in the native resolution
+static unsigned int Pixel(uint64_t const video[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS], unsigned int plane, unsigned int x, unsigned int y){
+    return (video[plane][y][x / 64] >> (63 - x % 64)) & 1u;
+}
+
+// true if plane 1 has any pixel set in the rows of the resolution
+static bool SecondPlaneUsed(uint64_t const video[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS], bool hires){
+    unsigned int height = hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+    for (unsigned int y = 0; y < height; ++y){
+        if (video[1][y][0] | video[1][y][1]){
+            return true;
+        }
+    }
+    return false;
+}
+
+Capture::Capture(){
+    memset(video, 0, sizeof(video));
+}
+
+Capture::~Capture(){
+    Close();
+}
+
+bool Capture::FormatFromName(char const* name, CaptureFormat& format){
+    if (strcmp(name, "raw") == 0){
+        format = CAPTURE_RAW;
+        return true;
+    }
+    if (strcmp(name, "ppm") == 0){
+        format = CAPTURE_PPM;
+        return true;
+    }
+    if (strcmp(name, "gif") == 0){
+        format = CAPTURE_GIF;
+        return true;
+    }
+    return false;
+}
+
+char const* Capture::FormatName(CaptureFormat format){
+    switch (format){
+        case CAPTURE_RAW:
+            return "raw";
+        case CAPTURE_PPM:
+            return "ppm";
+        default:
+            return "gif";
+    }
+}
+
+bool Capture::Open(char const* filename, CaptureFormat format){
+    Close();
+    this->format = format;
+    this->filename = filename;
+    frames = 0;
+    written = 0;
+    lastFrame = 0;
+    failed = false;
+    pending = false;
+    centiseconds = 0;
+    memset(video, 0, sizeof(video));
+    hires = false;
+    // big enough for a hi-res PPM, the largest frame of any format
+    buffer.reserve(64 + HIRES_WIDTH * HIRES_HEIGHT * 3);
+
+    if (format == CAPTURE_PPM){
+        open = true;
+        return true;
+    }
+
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()){
+        return false;
+    }
+
+    if (format == CAPTURE_RAW){
+        CaptureHeader header = { CAPTURE_MAGIC, CAPTURE_VERSION };
+        file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    }
+    else{
+        // the picture starts blank; every frame then only covers the rows that changed
+        pixels.assign(HIRES_WIDTH * HIRES_HEIGHT, 0);
+        codes.assign((GIF_MAX_CODE + 1) << GIF_COLOR_BITS, 0);
+
+        uint8_t header[] = {
+            'G', 'I', 'F', '8', '9', 'a',
+            // logical screen: 128 x 64, global palette of 2^GIF_COLOR_BITS colors, background 0
+            HIRES_WIDTH, 0, HIRES_HEIGHT, 0, 0xF0 | (GIF_COLOR_BITS - 1), 0, 0
+        };
+        file.write(reinterpret_cast<char const*>(header), sizeof(header));
+        file.write(reinterpret_cast<char const*>(GIF_PALETTE), sizeof(GIF_PALETTE));
+        // loop forever
+        uint8_t loop[] = { 0x21, 0xFF, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 3, 1, 0, 0, 0 };
+        file.write(reinterpret_cast<char const*>(loop), sizeof(loop));
+    }
+    open = true;
+    return file.good();
+}
+
+void Capture::Frame(Chip8 const& chip8){
+    if (!open){
+        return;
+    }
+    uint64_t frame = ++frames;
+
+    // the first frame is always written, so a capture is never empty
+    if (frame > 1 && chip8.Hires() == hires && memcmp(chip8.video, video, sizeof(video)) == 0){
+        return;
+    }
+
+    switch (format){
+        case CAPTURE_RAW:
+            memcpy(video, chip8.video, sizeof(video));
+            hires = chip8.Hires();
+            WriteRaw(frame - lastFrame);
+            break;
+        case CAPTURE_PPM:
+            memcpy(video, chip8.video, sizeof(video));
+            hires = chip8.Hires();
+            WritePpm(frame);
+            break;
+        default:
+            // the previous picture stayed up until now
+            if (pending){
+                FlushGif(frame);
+            }
+            QueueGif(chip8.video, chip8.Hires());
+            memcpy(video, chip8.video, sizeof(video));
+            hires = chip8.Hires();
+            break;
+    }
+    lastFrame = frame;
+    ++written;
+}
+
+bool Capture::Close(){
+    if (!open){
+        return !failed;
+    }
+    if (format == CAPTURE_GIF){
+        if (pending){
+            // the last picture counts for at least one frame
+            FlushGif(frames > lastFrame ? frames : lastFrame + 1);
+        }
+        file.put(0x3B);
+    }
+    if (file.is_open()){
+        failed |= !file.good();
+        file.close();
+    }
+    open = false;
+    return !failed;
+}
+
+void Capture::WriteRaw(uint64_t delta){
+    bool second = SecondPlaneUsed(video, hires);
+    unsigned int height = hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+    unsigned int words = hires ? ROW_WORDS : 1;
+
+    CaptureFrame header = { (uint32_t)delta, (uint8_t)(hires ? HIRES_WIDTH : VIDEO_WIDTH), (uint8_t)height,
+                            (uint8_t)(second ? 2 : 1), 0 };
+    buffer.assign(reinterpret_cast<uint8_t const*>(&header), reinterpret_cast<uint8_t const*>(&header) + sizeof(header));
+
+    // rows are stored big-endian, so the leftmost pixel lands in the first byte's top bit
+    for (unsigned int plane = 0; plane < (second ? 2u : 1u); ++plane){
+        for (unsigned int y = 0; y < height; ++y){
+            for (unsigned int w = 0; w < words; ++w){
+                for (int shift = 56; shift >= 0; shift -= 8){
+                    buffer.push_back((uint8_t)(video[plane][y][w] >> shift));
+                }
+            }
+        }
+    }
+    file.write(reinterpret_cast<char const*>(buffer.data()), buffer.size());
+}
+
+void Capture::WritePpm(uint64_t frame){
+    unsigned int width = hires ? HIRES_WIDTH : VIDEO_WIDTH;
+    unsigned int height = hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "_%08llu.ppm", (unsigned long long)frame);
+    std::ofstream ppm(filename + name, std::ios::binary | std::ios::trunc);
+
+    char header[32];
+    int headerLength = std::snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width, height);
+    buffer.assign(header, header + headerLength);
+    for (unsigned int y = 0; y < height; ++y){
+        for (unsigned int x = 0; x < width; ++x){
+            unsigned int color = Pixel(video, 0, x, y) | (Pixel(video, 1, x, y) << 1);
+            buffer.insert(buffer.end(), GIF_PALETTE[color], GIF_PALETTE[color] + 3);
+        }
+    }
+    ppm.write(reinterpret_cast<char const*>(buffer.data()), buffer.size());
+    failed |= !ppm.good();
+}
+
+void Capture::QueueGif(uint64_t const next[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS], bool nextHires){
+    unsigned int height = nextHires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+    // a low-resolution row is two rows of the 128 x 64 picture
+    unsigned int scale = nextHires ? 1 : 2;
+    bool first = true;
+
+    for (unsigned int y = 0; y < height; ++y){
+        bool changed = nextHires != hires || written == 0;
+        for (unsigned int plane = 0; plane < PLANE_COUNT && !changed; ++plane){
+            changed = next[plane][y][0] != video[plane][y][0] || next[plane][y][1] != video[plane][y][1];
+        }
+        if (!changed){
+            continue;
+        }
+
+        for (unsigned int x = 0; x < HIRES_WIDTH; ++x){
+            unsigned int sx = x / scale;
+            uint8_t color = Pixel(next, 0, sx, y) | (Pixel(next, 1, sx, y) << 1);
+            for (unsigned int r = 0; r < scale; ++r){
+                pixels[(y * scale + r) * HIRES_WIDTH + x] = color;
+            }
+        }
+        if (first){
+            pendingFirstRow = y * scale;
+            first = false;
+        }
+        pendingLastRow = y * scale + scale - 1;
+    }
+    pending = !first;
+}
+
+void Capture::FlushGif(uint64_t frame){
+    pending = false;
+
+    // delays are hundredths of a second; round the running total so they add up to the 60 Hz time
+    uint64_t end = (frame * 100 + TIMER_HZ / 2) / TIMER_HZ;
+    unsigned int delay = end > centiseconds ? (unsigned int)(end - centiseconds) : 0;
+    if (delay > 0xFFFF){
+        delay = 0xFFFF;
+    }
+    centiseconds += delay;
+
+    unsigned int rows = pendingLastRow - pendingFirstRow + 1;
+    uint8_t header[] = {
+        // graphic control: leave the picture in place for the next frame, which only covers changed rows
+        0x21, 0xF9, 4, 1 << 2, (uint8_t)delay, (uint8_t)(delay >> 8), 0, 0,
+        // image descriptor: full width, rows pendingFirstRow..pendingLastRow, global palette
+        0x2C, 0, 0, (uint8_t)pendingFirstRow, 0, HIRES_WIDTH, 0, (uint8_t)rows, 0, 0,
+        GIF_COLOR_BITS
+    };
+    file.write(reinterpret_cast<char const*>(header), sizeof(header));
+
+    // LZW over the palette indices
+    unsigned int const clearCode = 1u << GIF_COLOR_BITS;
+    unsigned int codeSize = GIF_COLOR_BITS + 1;
+    unsigned int maxCode = clearCode + 1;
+
+    buffer.clear();
+    uint32_t bits = 0;
+    unsigned int bitCount = 0;
+    auto emit = [this, &bits, &bitCount, &codeSize](unsigned int code){
+        bits |= code << bitCount;
+        bitCount += codeSize;
+        while (bitCount >= 8){
+            buffer.push_back((uint8_t)bits);
+            bits >>= 8;
+            bitCount -= 8;
+        }
+    };
+    // a new dictionary entry; the code after it needs another bit once the entries reach the next power of two
+    auto grow = [&maxCode, &codeSize](){
+        ++maxCode;
+        if (maxCode >= (1u << codeSize) && codeSize < 12){
+            ++codeSize;
+        }
+    };
+
+    emit(clearCode);
+    uint8_t const* data = &pixels[pendingFirstRow * HIRES_WIDTH];
+    size_t count = (size_t)rows * HIRES_WIDTH;
+    unsigned int current = data[0];
+    for (size_t i = 1; i < count; ++i){
+        uint8_t color = data[i];
+        uint16_t& child = codes[(current << GIF_COLOR_BITS) | color];
+        if (child != 0){
+            current = child;
+            continue;
+        }
+        emit(current);
+        child = (uint16_t)(maxCode + 1);
+        grow();
+        if (maxCode == GIF_MAX_CODE){
+            emit(clearCode);
+            // only entries up to maxCode have children
+            std::fill(codes.begin(), codes.begin() + ((maxCode + 1) << GIF_COLOR_BITS), 0);
+            codeSize = GIF_COLOR_BITS + 1;
+            maxCode = clearCode + 1;
+        }
+        current = color;
+    }
+    emit(current);
+    // the decoder adds an entry for the last code too, which may widen the end code
+    grow();
+    emit(clearCode + 1);
+    // leave the dictionary empty for the next frame
+    std::fill(codes.begin(), codes.begin() + ((maxCode + 1) << GIF_COLOR_BITS), 0);
+    if (bitCount > 0){
+        buffer.push_back((uint8_t)bits);
+    }
+
+    // sub-blocks of at most 255 bytes, then an empty one
+    for (size_t offset = 0; offset < buffer.size(); offset += 255){
+        size_t length = buffer.size() - offset < 255 ? buffer.size() - offset : 255;
+        file.put((char)length);
+        file.write(reinterpret_cast<char const*>(buffer.data() + offset), length);
+    }
+    file.put(0);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "chip8.hpp"
+
+// first four bytes of a raw capture: "C8VF" read as a little-endian word
+const uint32_t CAPTURE_MAGIC = 0x46563843;
+const uint32_t CAPTURE_VERSION = 1;
+
+enum CaptureFormat : uint8_t{
+    // one file of CaptureFrames, each followed by its 1 bpp planes
+    CAPTURE_RAW,
+    // one binary PPM per distinct frame, named <file>_<frame>.ppm
+    CAPTURE_PPM,
+    // one animated GIF at 128 x 64, low resolution drawn 2 x 2
+    CAPTURE_GIF
+};
+
+struct CaptureHeader{
+    uint32_t magic;
+    uint32_t version;
+};
+
+// A raw frame: the display from `delta` frames after the previous one (after
+// the start for the first) until the next. Followed by `planes` bitmaps of
+// height rows of width / 8 bytes, leftmost pixel in the most significant bit,
+// plane 0 first; plane 1 is left out while it is empty.
+struct CaptureFrame{
+    uint32_t delta;
+    uint8_t width;
+    uint8_t height;
+    uint8_t planes;
+    uint8_t unused;
+};
+
+/*
+ * Streams the display of a headless run to a file, one call per emulated frame.
+ * A frame is only written if the display changed since the last one, so a game
+ * that redraws a few times a second costs a memcmp per frame in between; raw and
+ * PPM frames say how many frames passed, and GIF frames how long they stay up.
+ * GIF frames only cover the rows that changed.
+ */
+class Capture{
+    public:
+        Capture();
+        ~Capture();
+
+        // start a capture; for PPM, filename is the prefix of every file. False if it cannot be created.
+        bool Open(char const* filename, CaptureFormat format);
+        // the display after one more emulated frame
+        void Frame(Chip8 const& chip8);
+        // finish the file; returns false if anything could not be written
+        bool Close();
+
+        // frames seen, and distinct frames written
+        uint64_t Frames() const { return frames; }
+        uint64_t Written() const { return written; }
+
+        // "raw", "ppm" or "gif"; returns false for an unknown name
+        static bool FormatFromName(char const* name, CaptureFormat& format);
+        static char const* FormatName(CaptureFormat format);
+
+    private:
+        CaptureFormat format{CAPTURE_RAW};
+        bool open{};
+        bool failed{};
+        std::string filename;
+        std::ofstream file;
+
+        uint64_t frames{};
+        uint64_t written{};
+        // frame the last written display appeared on
+        uint64_t lastFrame{};
+        // the last display written; compared against every new frame
+        uint64_t video[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS];
+        bool hires{};
+        // preallocated encoding space, reused by every frame
+        std::vector<uint8_t> buffer;
+
+        // GIF: palette indices of the displayed picture, and the rows not yet written because
+        // the time they stay up is only known once the display changes again
+        std::vector<uint8_t> pixels;
+        unsigned int pendingFirstRow{};
+        unsigned int pendingLastRow{};
+        bool pending{};
+        // hundredths of a second of delays written so far
+        uint64_t centiseconds{};
+        // LZW dictionary as a trie: codes[code * 4 + color] is the code for code's string plus color, or 0
+        std::vector<uint16_t> codes;
+
+        void WriteRaw(uint64_t delta);
+        void WritePpm(uint64_t frame);
+        // queue the rows of the new display that differ from the GIF picture
+        void QueueGif(uint64_t const next[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS], bool nextHires);
+        // write the queued rows, shown until `frame`
+        void FlushGif(uint64_t frame);
+
+        Capture(Capture const&);
+        Capture& operator=(Capture const&);
+};
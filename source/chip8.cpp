@@ -1,17 +1,19 @@
 #include "chip8.hpp"
+#include "jit.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
 #include <fstream>
 #include <chrono>
+#include <algorithm>
 #include <cstdint>
-#include <random>
 #include <cstring>
-#include <iostream>
-#include <stdlib.h> 
 
-const unsigned int START_ADDRESS = 0x200;
-const unsigned int FONTSET_SIZE = 80;
-const unsigned int FONTSET_START_ADDRESS = 0x50;
+// longest loop, in instructions, that Run() tries to recognize as idle
+const unsigned int MAX_IDLE_LOOP = 16;
+// instructions run between two looks for an idle loop
+const unsigned int IDLE_CHECK_INTERVAL = 256;
 
-void Chip8::LoadROM(char const* filename){
+bool Chip8::LoadROM(char const* filename){
     // Open file and point file pointer at the end of the file
     // | std::ios::ate sets file pointer to the end
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
@@ -27,14 +29,29 @@ void Chip8::LoadROM(char const* filename){
         file.read(buffer,size);
         file.close();
 
-        // LD ROM contents into CHIP-8's memory, starting at 0x200
-        for (long i = 0; i < size; ++i){ //why is this ++i, not i++? ++i does not create copies. So optimization?
-            memory[START_ADDRESS + i]= buffer[i];
-        }
+        bool loaded = LoadROM(reinterpret_cast<uint8_t const*>(buffer), size);
 
         // free the runtime stack after copying the rom contents over
         delete[] buffer;
+
+        return loaded;
+    }
+    return false;
+}
+
+bool Chip8::LoadROM(uint8_t const* data, size_t size){
+    // program space runs from 0x200 to the end of memory
+    if (size > MemorySize() - START_ADDRESS){
+        return false;
     }
+
+    // LD ROM contents into CHIP-8's memory, starting at 0x200
+    for (size_t i = 0; i < size; ++i){ //why is this ++i, not i++? ++i does not create copies. So optimization?
+        memory[START_ADDRESS + i]= data[i];
+    }
+
+    Predecode(START_ADDRESS, size);
+    return true;
 }
 
 // Font pixel data. Source: austin/Chip8-emulator
@@ -58,96 +75,270 @@ uint8_t fontset[FONTSET_SIZE] =
 	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-// Create a constructor where PC is initialized to 0x200
-Chip8::Chip8() 
-    // sets a seed of randome engine using current time. Since data member randbyte is uint8_t, its from 0 to 255
-    : randGen(std::chrono::system_clock::now().time_since_epoch().count())
+// SCHIP's 8x10 digits, with XO-CHIP's A-F. Source: Octo
+uint8_t bigfont[BIGFONT_SIZE] =
+{
+	0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+	0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+	0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+	0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+	0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+	0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+	0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+	0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+// Seeds the random bytes using current time, so every run is different
+Chip8::Chip8()
+    : Chip8(std::chrono::system_clock::now().time_since_epoch().count())
     {
+}
+
+// Create a constructor where PC is initialized to 0x200
+Chip8::Chip8(uint64_t seed){
+    random.Seed(seed);
+
     // Initialize PC
     pc = START_ADDRESS;
 
+    // Decode table
+    // First digit 0 is decoded through table0 by the last two digits
+    table[0x0] = OPID_NULL;
+    // table[0x1:0xD] points to functions whose entire opcode is unique
+    table[0x1] = OPID_1nnn;
+    table[0x2] = OPID_2nnn;
+    table[0x3] = OPID_3xkk;
+    table[0x4] = OPID_4xkk;
+    // first digit 5 is decoded through table5 by last digit
+    table[0x5] = OPID_NULL;
+    table[0x6] = OPID_6xkk;
+    table[0x7] = OPID_7xkk;
+    table[0x8] = OPID_NULL;
+    table[0x9] = OPID_9xy0;
+    table[0xA] = OPID_Annn;
+    table[0xB] = OPID_Bnnn;
+    table[0xC] = OPID_Cxkk;
+    table[0xD] = OPID_Dxyn;
+    // first digit E is decoded through tableE by last digit
+    table[0xE] = OPID_NULL;
+    // first digit F is decoded through tableF by last two digits
+    table[0xF] = OPID_NULL;
+
+    // initialize array with OP_NULL for malformed opcodes
+    for (size_t i = 0; i <= 0xE; ++i){
+        tableE[i] = OPID_NULL;
+        table8[i] = OPID_NULL;
+    }
+
+    // Opcodes with first digit 8
+    table8[0x0] = OPID_8xy0;
+    table8[0x1] = OPID_8xy1;
+    table8[0x2] = OPID_8xy2;
+    table8[0x3] = OPID_8xy3;
+    table8[0x4] = OPID_8xy4;
+    table8[0x5] = OPID_8xy5;
+    table8[0x6] = OPID_8xy6;
+    table8[0x7] = OPID_8xy7;
+    table8[0xE] = OPID_8xyE;
+
+    // Opcodes with first digit E
+    tableE[0x1] = OPID_ExA1;
+    tableE[0xE] = OPID_Ex9E;
+
+    for (size_t i = 0; i <= 0x85; ++i){
+        tableF[i] = OPID_NULL;
+    }
+    // Opcodes with first digit F
+    tableF[0x07] = OPID_Fx07;
+    tableF[0x0A] = OPID_Fx0A;
+    tableF[0x15] = OPID_Fx15;
+    tableF[0x18] = OPID_Fx18;
+    tableF[0x1E] = OPID_Fx1E;
+    tableF[0x29] = OPID_Fx29;
+    tableF[0x33] = OPID_Fx33;
+    tableF[0x55] = OPID_Fx55;
+    tableF[0x65] = OPID_Fx65;
+
+    // table0, table5 and the SCHIP/XO-CHIP entries of tableF, and memory
+    ApplyVariant();
+
     // Load font data into buffer
     for (unsigned int i = 0; i < FONTSET_SIZE; ++i){
         memory[FONTSET_START_ADDRESS + i] = fontset[i];
     }
 
-    // Initialize rand num generator of range (0, 255) 
-    randByte = std::uniform_int_distribution<uint8_t>(0, 255U);
+    // decode the font and the empty program area once; LoadROM refreshes the rest
+    Predecode(0, MEMORY_SIZE);
+}
+
+void Chip8::SetVariant(Variant variant){
+    this->variant = variant;
+    ApplyVariant();
 
-    // Function pointer table
-    // First three letter is 00E, Tb0 function makes the class pointer depending on last digit (0 or E)
-    table[0x0] = &Chip8::Tb0;
-    // table[0x1:0xD] points to functions whose entire opcode is unique
-    table[0x1] = &Chip8::OP_1nnn;
-    table[0x2] = &Chip8::OP_2nnn;
-    table[0x3] = &Chip8::OP_3xkk;
-    table[0x4] = &Chip8::OP_4xkk;
-    table[0x5] = &Chip8::OP_5xy0;
-    table[0x6] = &Chip8::OP_6xkk;
-    table[0x7] = &Chip8::OP_7xkk;
-    table[0x8] = &Chip8::Tb8;
-    table[0x9] = &Chip8::OP_9xy0;
-    table[0xA] = &Chip8::OP_Annn;
-    table[0xB] = &Chip8::OP_Bnnn;
-    table[0xC] = &Chip8::OP_Cxkk;
-    table[0xD] = &Chip8::OP_Dxyn;
-    // TbE points to a function that matches its opcode and whose first digit is E
-    table[0xE] = &Chip8::TbE;
-    // TbF points to a function that matches its opcode and whose first digit is E
-    table[0xF] = &Chip8::TbF;
+    if (variant != VARIANT_CHIP8){
+        memcpy(memory + BIGFONT_START_ADDRESS, bigfont, BIGFONT_SIZE);
+    }
 
-    // initialize array with OP_NULL for malformed opcodes
-    for (size_t i = 0; i <= 0xE; ++i){
-        table0[i] = &Chip8::OP_NULL;
-        tableE[i] = &Chip8::OP_NULL;
-        table8[i] = &Chip8::OP_NULL;
-    }
-    // Function pointer for Opcodes with first three digit 00E and last two E0
-    table0[0x0] = &Chip8::OP_00E0;
-    // Function pointer for Opcodes with first three digit 00E and last two EE
-    table0[0xE] = &Chip8::OP_00EE;
-
-    // Function pointers for Opcodes with first digit 8
-    table8[0x0] = &Chip8::OP_8xy0;
-    table8[0x1] = &Chip8::OP_8xy1;
-    table8[0x2] = &Chip8::OP_8xy2;
-    table8[0x3] = &Chip8::OP_8xy3;
-    table8[0x4] = &Chip8::OP_8xy4;
-    table8[0x5] = &Chip8::OP_8xy5;
-    table8[0x6] = &Chip8::OP_8xy6;
-    table8[0x7] = &Chip8::OP_8xy7;
-    table8[0xE] = &Chip8::OP_8xyE;
-
-    // Function pointers for Opcodes with first digit E
-    tableE[0x1] = &Chip8::OP_ExA1;
-    tableE[0xE] = &Chip8::OP_Ex9E;
-
-    for (size_t i = 0; i <= 0x65; ++i){
-        tableF[i] = &Chip8::OP_NULL;
-    }
-    // Function pointers for Opcodes with first digit F
-    tableF[0x07] = &Chip8::OP_Fx07;
-    tableF[0x0A] = &Chip8::OP_Fx0A;
-    tableF[0x15] = &Chip8::OP_Fx15;
-    tableF[0x18] = &Chip8::OP_Fx18;
-    tableF[0x1E] = &Chip8::OP_Fx1E;
-    tableF[0x29] = &Chip8::OP_Fx29;
-    tableF[0x33] = &Chip8::OP_Fx33;
-    tableF[0x55] = &Chip8::OP_Fx55;
-    tableF[0x65] = &Chip8::OP_Fx65;
+    // the same bytes may decode to other instructions now, and XO-CHIP has more of them
+    Predecode(0, MemorySize());
+}
+
+void Chip8::ApplyVariant(){
+    unsigned int size = variant == VARIANT_XOCHIP ? XO_MEMORY_SIZE : MEMORY_SIZE;
+    if (memory == nullptr || size != MemorySize()){
+        std::unique_ptr<uint8_t[]> resized(new uint8_t[size]());
+        if (memory != nullptr){
+            memcpy(resized.get(), memory, std::min(size, MemorySize()));
+        }
+        memoryStorage.swap(resized);
+        decodedStorage.reset(new Instruction[size]());
+        memory = memoryStorage.get();
+        decoded = decodedStorage.get();
+    }
+    memoryMask = size - 1;
+
+    for (size_t i = 0; i <= 0xFF; ++i){
+        if (variant == VARIANT_CHIP8){
+            // CHIP-8 only looks at the last digit: 0 is 00E0 and E is 00EE
+            table0[i] = (i & 0xF) == 0x0 ? OPID_00E0 : (i & 0xF) == 0xE ? OPID_00EE : OPID_NULL;
+        }
+        else{
+            table0[i] = OPID_NULL;
+        }
+    }
+    for (size_t i = 0; i <= 0xF; ++i){
+        // before XO-CHIP the last digit of 5xy0 is not looked at
+        table5[i] = variant == VARIANT_XOCHIP ? OPID_NULL : OPID_5xy0;
+    }
+    tableF[0x00] = OPID_NULL;
+    tableF[0x01] = OPID_NULL;
+    tableF[0x02] = OPID_NULL;
+    tableF[0x30] = OPID_NULL;
+    tableF[0x3A] = OPID_NULL;
+    tableF[0x75] = OPID_NULL;
+    tableF[0x85] = OPID_NULL;
+
+    if (variant == VARIANT_CHIP8){
+        return;
+    }
+
+    // SCHIP and XO-CHIP need all of the last two digits to tell 00E0 from 00C0 and 00F0
+    table0[0xE0] = OPID_00E0;
+    table0[0xEE] = OPID_00EE;
+    for (size_t n = 0; n <= 0xF; ++n){
+        table0[0xC0 + n] = OPID_00Cn;
+    }
+    table0[0xFB] = OPID_00FB;
+    table0[0xFC] = OPID_00FC;
+    table0[0xFD] = OPID_00FD;
+    table0[0xFE] = OPID_00FE;
+    table0[0xFF] = OPID_00FF;
+    tableF[0x30] = OPID_Fx30;
+    tableF[0x75] = OPID_Fx75;
+    tableF[0x85] = OPID_Fx85;
+
+    if (variant == VARIANT_SCHIP){
+        return;
+    }
+
+    for (size_t n = 0; n <= 0xF; ++n){
+        table0[0xD0 + n] = OPID_00Dn;
+    }
+    table5[0x0] = OPID_5xy0;
+    table5[0x2] = OPID_5xy2;
+    table5[0x3] = OPID_5xy3;
+    tableF[0x00] = OPID_F000;
+    tableF[0x01] = OPID_Fx01;
+    tableF[0x02] = OPID_F002;
+    tableF[0x3A] = OPID_Fx3A;
+}
+
+// Function pointer table, in OpId order
+const Chip8::Chip8Func Chip8::handlers[OPID_COUNT] = {
+    &Chip8::OP_NULL,
+    &Chip8::OP_00E0,
+    &Chip8::OP_00EE,
+    &Chip8::OP_1nnn,
+    &Chip8::OP_2nnn,
+    &Chip8::OP_3xkk,
+    &Chip8::OP_4xkk,
+    &Chip8::OP_5xy0,
+    &Chip8::OP_6xkk,
+    &Chip8::OP_7xkk,
+    &Chip8::OP_8xy0,
+    &Chip8::OP_8xy1,
+    &Chip8::OP_8xy2,
+    &Chip8::OP_8xy3,
+    &Chip8::OP_8xy4,
+    &Chip8::OP_8xy5,
+    &Chip8::OP_8xy6,
+    &Chip8::OP_8xy7,
+    &Chip8::OP_8xyE,
+    &Chip8::OP_9xy0,
+    &Chip8::OP_Annn,
+    &Chip8::OP_Bnnn,
+    &Chip8::OP_Cxkk,
+    &Chip8::OP_Dxyn,
+    &Chip8::OP_Ex9E,
+    &Chip8::OP_ExA1,
+    &Chip8::OP_Fx07,
+    &Chip8::OP_Fx0A,
+    &Chip8::OP_Fx15,
+    &Chip8::OP_Fx18,
+    &Chip8::OP_Fx1E,
+    &Chip8::OP_Fx29,
+    &Chip8::OP_Fx33,
+    &Chip8::OP_Fx55,
+    &Chip8::OP_Fx65,
+    &Chip8::OP_00Cn,
+    &Chip8::OP_00FB,
+    &Chip8::OP_00FC,
+    &Chip8::OP_00FD,
+    &Chip8::OP_00FE,
+    &Chip8::OP_00FF,
+    &Chip8::OP_Fx30,
+    &Chip8::OP_Fx75,
+    &Chip8::OP_Fx85,
+    &Chip8::OP_00Dn,
+    &Chip8::OP_5xy2,
+    &Chip8::OP_5xy3,
+    &Chip8::OP_F000,
+    &Chip8::OP_Fx01,
+    &Chip8::OP_F002,
+    &Chip8::OP_Fx3A,
+};
+
+// defined here because Jit, Profile and Trace are incomplete in chip8.hpp
+Chip8::~Chip8(){
+}
+
+Trace& Chip8::EnableTrace(size_t capacity){
+    trace.reset(new Trace(capacity));
+    return *trace;
+}
+
+Profile& Chip8::EnableProfile(){
+    profile.reset(new Profile());
+    return *profile;
 }
 
 void Chip8::Cycle(){
     /*
      * Instruction Cycle: Fetch
-     * Fetch opcode from memory where PC is pointing. Each memory location stores
-     * single byte, while an opcode is 2 bytes. Therefore, a byte at PC is fetched,
-     * right bit shifted, and another byte is OR'd so two bytes are combined.
+     * The instruction at PC was already fetched and decoded by Predecode, so
+     * fetching is a single array lookup. PC is masked so a runaway program
+     * cannot read outside memory.
      */
-    system("clear -x");
-    opcode = (memory[pc] << 8u) | memory[pc+1];    
-    std::cout << "executing "<<std::hex<<(int)opcode<<std::endl;
-    std::cout << "PC: "<<std::hex<<(int)pc<<std::endl;
+    uint16_t address = pc & memoryMask;
+    Instruction const& instruction = decoded[address];
 
     /*
      * Instruction Cycle: Increment PC
@@ -157,21 +348,240 @@ void Chip8::Cycle(){
     pc += 2;
 
     /*
-     * Instruction Cycle: Decode & Execute
-     * Decode and execute opcode at the same time using function table!
-     * 12 bit is shifted to the right since our function table looks at first
-     * digit of the opcode.
+     * Instruction Cycle: Execute
+     * The handler was looked up in the decode tables ahead of time, so this is
+     * one indexed call. Profiling takes a slower path that counts and times the
+     * instruction; when it is off this is a single, always-not-taken branch.
      */
-    ((*this).*(table[(opcode & 0xF000u) >> 12u]))();
+#ifndef CHIP8_NO_PROFILE
+    if (profile){
+        ExecuteProfiled(address, instruction);
+    }
+    else{
+        ((*this).*(handlers[instruction.id]))(instruction);
+    }
+#else
+    ((*this).*(handlers[instruction.id]))(instruction);
+#endif
+
+#ifndef CHIP8_NO_TRACE
+    // Record the instruction for debugging. When tracing is off this is a
+    // single, always-not-taken branch.
+    if (trace){
+        uint16_t opcode = (memory[address] << 8u) | memory[(address + 1) & memoryMask];
+        trace->Record(address, opcode, index, sp, delayTimer, registers);
+    }
+#endif
+}
+
+unsigned int Chip8::Run(unsigned int count){
+    // The keypad only changes between calls, so a blocked Fx0A would re-execute for the whole
+    // budget. Skip that, and let the engines stop as soon as an Fx0A blocks.
+    if (Blocked()){
+        CountBlocked(count);
+        return count;
+    }
+    keyWait = false;
+
+    // tracing wants every instruction
+    if (!idleSkip || trace){
+        return RunEngine(count);
+    }
+
+    // The budget is run in chunks; before each, an idle loop at pc is skipped to the end of the budget.
+    unsigned int executed = 0;
+    while (executed < count){
+        if (NearIdleLoop()){
+            executed += SkipIdleLoop(count - executed);
+        }
+        if (executed < count && !keyWait){
+            executed += RunEngine(std::min(IDLE_CHECK_INTERVAL, count - executed));
+        }
+        if (keyWait){
+            CountBlocked(count - executed);
+            break;
+        }
+    }
+    return count;
+}
+
+unsigned int Chip8::RunEngine(unsigned int count){
+    // tracing and profiling are only recorded by Cycle(), so such a run always uses the table engine
+    if (engine == ENGINE_THREADED && !trace && !profile){
+        return RunThreaded(count);
+    }
+    if (engine == ENGINE_JIT && !trace && !profile){
+        return jit->Run(count);
+    }
+
+    for (unsigned int i = 0; i < count; ++i){
+        Cycle();
+        if (keyWait){
+            CountBlocked(count - i - 1);
+            break;
+        }
+    }
+    return count;
+}
+
+bool Chip8::NearIdleLoop() const{
+    unsigned int start = pc & memoryMask;
+    unsigned int address = start;
+    for (unsigned int i = 0; i < MAX_IDLE_LOOP && address < MemorySize(); ++i, address += 2){
+        Instruction const& instruction = decoded[address];
+        if (instruction.id == OPID_1nnn && instruction.nnn <= start && address - instruction.nnn < 2 * MAX_IDLE_LOOP){
+            return true;
+        }
+        // SCHIP's exit stays on itself
+        if (instruction.id == OPID_00FD && address == start){
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned int Chip8::SkipIdleLoop(unsigned int count){
+    // With timers and keys fixed for the whole Run, an iteration that ends in the state it
+    // started from repeats forever. Memory, display, stack, timers and the random generator
+    // are only left alone if none of the opcodes below ran, so comparing registers, index, sp
+    // and pc is enough.
+    uint16_t start = pc;
+    uint16_t startIndex = index;
+    uint8_t startSp = sp;
+    uint8_t startRegisters[REGISTER_COUNT];
+    memcpy(startRegisters, registers, sizeof(startRegisters));
+
+    unsigned int length = 0;
+    do{
+        if (length == count){
+            return length;
+        }
+
+        bool sideEffects;
+        switch (decoded[pc & memoryMask].id){
+            case OPID_00E0:
+            case OPID_00EE:
+            case OPID_2nnn:
+            case OPID_Cxkk:
+            case OPID_Dxyn:
+            case OPID_Fx0A:
+            case OPID_Fx15:
+            case OPID_Fx18:
+            case OPID_Fx33:
+            case OPID_Fx55:
+            case OPID_00Cn:
+            case OPID_00FB:
+            case OPID_00FC:
+            case OPID_00FE:
+            case OPID_00FF:
+            case OPID_Fx75:
+            case OPID_00Dn:
+            case OPID_5xy2:
+            case OPID_Fx01:
+            case OPID_F002:
+            case OPID_Fx3A:
+                sideEffects = true;
+                break;
+            default:
+                sideEffects = false;
+                break;
+        }
+
+        // the probe is real execution and counts toward the budget
+        Cycle();
+        ++length;
+        if (sideEffects){
+            return length;
+        }
+    } while (pc != start && length < MAX_IDLE_LOOP);
+
+    if (pc != start || index != startIndex || sp != startSp || memcmp(registers, startRegisters, sizeof(startRegisters)) != 0){
+        return length;
+    }
+
+    unsigned int skipped = (count - length) / length * length;
+    skippedInstructions += skipped;
+#ifndef CHIP8_NO_PROFILE
+    if (profile && skipped > 0){
+        profile->CountSkipped(skipped);
+    }
+#endif
+    return length + skipped;
+}
+
+void Chip8::CountBlocked(unsigned int instructions){
+#ifndef CHIP8_NO_PROFILE
+    if (profile && instructions > 0){
+        profile->CountBlocked(instructions);
+    }
+#endif
+}
+
+void Chip8::SetEngine(Engine engine){
+    this->engine = engine;
 
-    // Print out register values for debugging
-    for(int i = 0; i < 16; i += 4){
-        std::cout << "V" << i << ": " << std::hex<< (int)registers[i] << "\t";
-        std::cout << "V" << i+1 << ": " << std::hex<< (int)registers[i+1] << "\t";
-        std::cout << "V" << i+2 << ": " << std::hex<< (int)registers[i+2] << "\t";
-        std::cout << "V" << i+3 << ": " << std::hex<< (int)registers[i+3] << std::endl;
+    if (engine == ENGINE_JIT && !jit){
+        jit.reset(new Jit(*this));
     }
-    std::cout<<std::endl;
+}
+
+bool Chip8::VariantFromName(char const* name, Variant& variant){
+    if (strcmp(name, "chip8") == 0){
+        variant = VARIANT_CHIP8;
+        return true;
+    }
+    if (strcmp(name, "schip") == 0){
+        variant = VARIANT_SCHIP;
+        return true;
+    }
+    if (strcmp(name, "xochip") == 0){
+        variant = VARIANT_XOCHIP;
+        return true;
+    }
+    return false;
+}
+
+char const* Chip8::VariantName(Variant variant){
+    switch (variant){
+        case VARIANT_SCHIP:
+            return "schip";
+        case VARIANT_XOCHIP:
+            return "xochip";
+        case VARIANT_CHIP8:
+        default:
+            return "chip8";
+    }
+}
+
+bool Chip8::EngineFromName(char const* name, Engine& engine){
+    if (strcmp(name, "table") == 0){
+        engine = ENGINE_TABLE;
+        return true;
+    }
+    if (strcmp(name, "threaded") == 0){
+        engine = ENGINE_THREADED;
+        return true;
+    }
+    if (strcmp(name, "jit") == 0){
+        engine = ENGINE_JIT;
+        return true;
+    }
+    return false;
+}
+
+char const* Chip8::EngineName(Engine engine){
+    switch (engine){
+        case ENGINE_THREADED:
+            return "threaded";
+        case ENGINE_JIT:
+            return "jit";
+        case ENGINE_TABLE:
+        default:
+            return "table";
+    }
+}
+
+void Chip8::TickTimers(){
     // Decrement delay timer if set
     if(delayTimer > 0){
         --delayTimer;
@@ -184,34 +594,77 @@ void Chip8::Cycle(){
 }
 
 /*
- * This gets the pointer of the current object, dereferences it, then dereferences the function 
- * pointed by the function pointer array. What a mouthfull!
- * 
- * Tb0 function bimasks and extracts only last digit of an opcode,
- * and this digit is used to access the matching function in the array.
- * Only Opocdes that passes this function is opcodes whose first three digit is 00E
+ * Decode: split opcode into its fields and find its handler.
+ * The first digit selects the handler from table, except for opcodes starting
+ * with 5, 8 or E (keyed by the last digit) and 0 or F (keyed by the last two digits),
+ * which go through their own table. Digits past the end of a table are malformed.
  */
-void Chip8::Tb0(){
-    ((*this).*(table0[opcode & 0x000Fu]))();
+Instruction Chip8::Decode(uint16_t opcode) const{
+    Instruction instruction;
+    instruction.x = (opcode & 0x0F00u) >> 8u;
+    instruction.y = (opcode & 0x00F0u) >> 4u;
+    instruction.n = opcode & 0x000Fu;
+    instruction.kk = opcode & 0x00FFu;
+    instruction.nnn = opcode & 0x0FFFu;
+
+    switch ((opcode & 0xF000u) >> 12u){
+        case 0x0:
+            instruction.id = table0[instruction.kk];
+            break;
+        case 0x5:
+            instruction.id = table5[instruction.n];
+            break;
+        case 0x8:
+            instruction.id = instruction.n <= 0xE ? table8[instruction.n] : OPID_NULL;
+            break;
+        case 0xE:
+            instruction.id = instruction.n <= 0xE ? tableE[instruction.n] : OPID_NULL;
+            break;
+        case 0xF:
+            instruction.id = instruction.kk <= 0x85 ? tableF[instruction.kk] : OPID_NULL;
+            break;
+        default:
+            instruction.id = table[(opcode & 0xF000u) >> 12u];
+            break;
+    }
+    return instruction;
 }
 
-// Only Opocdes that passes this function is opcodes whose first digit is 8
-void Chip8::Tb8(){
-    ((*this).*(table8[opcode & 0x000Fu]))();
-}
+/*
+ * Memory was written, so the cached instructions that read those bytes are stale.
+ * An instruction at addr covers addr and addr + 1, so the one starting just before
+ * the range is refreshed too.
+ */
+void Chip8::Predecode(unsigned int address, unsigned int length){
+    // a range that runs off the end of memory carries on at 0, as the stores that wrote it did
+    address &= memoryMask;
+    length = std::min(length, MemorySize());
+    if (address + length > MemorySize()){
+        unsigned int head = MemorySize() - address;
+        Predecode(address, head);
+        Predecode(0, length - head);
+        return;
+    }
+    // the instruction at the last address takes its second byte from address 0
+    if (address == 0 && length > 0){
+        decoded[memoryMask] = Decode((memory[memoryMask] << 8u) | memory[0]);
+    }
 
-// Only Opocdes that passes this function is opcodes whose first digit is E
-void Chip8::TbE(){
-    ((*this).*(tableE[opcode & 0x000Fu]))();
-}
+    unsigned int first = address > 0 ? address - 1 : 0;
+    unsigned int last = address + length < MemorySize() ? address + length : MemorySize();
+
+    for (unsigned int addr = first; addr < last; ++addr){
+        uint16_t opcode = (memory[addr] << 8u) | memory[(addr + 1) & memoryMask];
+        decoded[addr] = Decode(opcode);
+    }
 
-// Only Opocdes that passes this function is opcodes whose first digit is F
-void Chip8::TbF(){
-    ((*this).*(tableF[opcode & 0x00FFu]))();
+    if (jit){
+        jit->Invalidate(address, length);
+    }
 }
 
 // NULL function for invalid OPs
-void Chip8::OP_NULL(){
+void Chip8::OP_NULL(Instruction const& instruction){
 }
 
 /* 
@@ -219,8 +672,89 @@ Opcode: 00E0 (CLS)
 Functionality: Clear the display
 Implementation: Clear the video array's buffer to zero
 */
-void Chip8::OP_00E0(){
-    memset(video, 0, sizeof(video));
+void Chip8::OP_00E0(Instruction const& instruction){
+    ClearScreen();
+}
+
+void Chip8::ClearScreen(){
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane){
+        if (!(planes & (1u << plane))){
+            continue;
+        }
+        if (hires){
+            memset(video[plane], 0, HIRES_HEIGHT * sizeof(video[plane][0]));
+        }
+        else{
+            // word 1 of a low-resolution row is always blank
+            for (unsigned int y = 0; y < VIDEO_HEIGHT; ++y){
+                video[plane][y][0] = 0;
+            }
+        }
+    }
+    dirtyRows = ~0ULL;
+}
+
+/*
+ * Scrolling works on whole packed rows: moving the display down is a memmove of
+ * row words, and moving it sideways shifts the two words of each row, so a scroll
+ * costs at most 64 rows of 16 bytes per plane whatever is on the screen.
+ */
+void Chip8::ScrollRows(int distance){
+    unsigned int height = VideoHeight();
+    unsigned int rows = distance < 0 ? -distance : distance;
+    if (rows > height){
+        rows = height;
+    }
+
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane){
+        if (!(planes & (1u << plane))){
+            continue;
+        }
+        uint64_t (*lines)[ROW_WORDS] = video[plane];
+        if (distance > 0){
+            memmove(lines + rows, lines, (height - rows) * sizeof(lines[0]));
+            memset(lines, 0, rows * sizeof(lines[0]));
+        }
+        else{
+            memmove(lines, lines + rows, (height - rows) * sizeof(lines[0]));
+            memset(lines + height - rows, 0, rows * sizeof(lines[0]));
+        }
+    }
+    dirtyRows = ~0ULL;
+}
+
+void Chip8::ScrollColumns(int distance){
+    // only 00FB/00FC scroll sideways, always by 4 columns
+    unsigned int columns = distance < 0 ? -distance : distance;
+
+    unsigned int height = VideoHeight();
+
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane){
+        if (!(planes & (1u << plane))){
+            continue;
+        }
+        // one loop per case, so the rows are shifted without a branch each
+        uint64_t (*lines)[ROW_WORDS] = video[plane];
+        if (!hires){
+            // word 1 stays blank; what leaves column 63 is gone
+            for (unsigned int y = 0; y < height; ++y){
+                lines[y][0] = distance > 0 ? lines[y][0] >> columns : lines[y][0] << columns;
+            }
+        }
+        else if (distance > 0){
+            for (unsigned int y = 0; y < height; ++y){
+                lines[y][1] = (lines[y][1] >> columns) | (lines[y][0] << (64 - columns));
+                lines[y][0] >>= columns;
+            }
+        }
+        else{
+            for (unsigned int y = 0; y < height; ++y){
+                lines[y][0] = (lines[y][0] << columns) | (lines[y][1] >> (64 - columns));
+                lines[y][1] <<= columns;
+            }
+        }
+    }
+    dirtyRows = ~0ULL;
 }
 
 /*
@@ -228,19 +762,18 @@ Opcode: 00EE (RET)
 Functionality: Return from a subroutine
 Implementation: Pop 1 from SP and apply it to PC; SP is TOS
 */
-void Chip8::OP_00EE(){
+void Chip8::OP_00EE(Instruction const& instruction){
     --sp;
-    pc = stack[sp];
+    pc = stack[sp & (STACK_LEVEL - 1)];
 }
 
 /*
 Opcode: 1nnn (JP)
 Functionality: Jump to memory location nnn
-Implementation: bitmask opcode to extract nnn and aply it to PC
+Implementation: apply the decoded nnn to PC
 */
-void Chip8::OP_1nnn(){
-    // bitmask with 0x0FFF will only leave the last three HEX codes
-    uint16_t address = opcode & 0x0FFFu;
+void Chip8::OP_1nnn(Instruction const& instruction){
+    uint16_t address = instruction.nnn;
 
     pc = address;
 }
@@ -250,14 +783,13 @@ Opcode: 2nnn (CALL)
 Functionality: Call subroutine at nnn
 Implementation: Push PC into stack and change PC to nnn
 */
-void Chip8::OP_2nnn(){
+void Chip8::OP_2nnn(Instruction const& instruction){
 
-    // Push PC into stack and increment sp
-    stack[sp] = pc;
+    // Push PC into stack and increment sp; more than STACK_LEVEL calls deep wraps around
+    stack[sp & (STACK_LEVEL - 1)] = pc;
     ++sp;
 
-    // Bitmask with 0x0FFF
-    uint16_t address = opcode & 0x0FFFu;
+    uint16_t address = instruction.nnn;
 
     pc = address;
 }
@@ -265,17 +797,16 @@ void Chip8::OP_2nnn(){
 /*
 Opcode: 3xkk (SE Vx, byte)
 Functionality: Skip next instruction if register vx has value kk
-Implementation: Bitmask opcode with 0x0F00 and bit right shift 8 times to find x.
-Then bitmask opcode again with 0x00FF to extract kk. Add 2 to PC if kk == v[x]
+Implementation: Add 2 to PC if kk == v[x]. x and kk were extracted by Decode.
 */
-void Chip8::OP_3xkk(){
+void Chip8::OP_3xkk(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t x = instruction.x;
     
-    uint8_t kk = opcode & 0x00FFu;
+    uint8_t kk = instruction.kk;
 
     if(registers[x] == kk){
-        pc += 2;
+        Skip();
     }
 }
 
@@ -284,43 +815,43 @@ Opcode: 4xkk (SNE Vx, byte)
 Functionality: Skip next instruction if register vx does not have value kk
 Implementation: Same as 3xkk, but if statement is != instead of ==
 */
-void Chip8::OP_4xkk(){
+void Chip8::OP_4xkk(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u) >> 8u;;
+    uint8_t x = instruction.x;
     
-    uint8_t kk = opcode & 0x00FFu;
+    uint8_t kk = instruction.kk;
 
     if(registers[x] != kk){
-        pc += 2;
+        Skip();
     }
 }
 
 /*
 Opcode: 5xy0 (SE Vx, Vy)
 Functionality: Skip next instruction if register vx == register vy
-Implementation: Netmask x and y and right bit shift accordingly, compare them using conditionals
+Implementation: Compare v[x] and v[y] using conditionals
 */
-void Chip8::OP_5xy0(){
+void Chip8::OP_5xy0(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t x = instruction.x;
     
-    uint8_t y = (opcode & 0x00F0u) >> 4u;
+    uint8_t y = instruction.y;
 
     if(registers[x] == registers[y]){
-        pc += 2;
+        Skip();
     }
 }
 
 /*
 Opcode: 6xkk (LD Vx, byte)
 Functionality: Load kk into register Vx
-Implementation: Netmask kk and load it into registers[x]
+Implementation: Load kk into registers[x]
 */
-void Chip8::OP_6xkk(){
+void Chip8::OP_6xkk(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t x = instruction.x;
     
-    uint8_t kk = opcode & 0x00FFu;
+    uint8_t kk = instruction.kk;
 
     registers[x] = kk;
 }
@@ -328,13 +859,13 @@ void Chip8::OP_6xkk(){
 /*
 Opcode: 7xkk (ADD Vx, byte)
 Functionality: Add immediate value to register x
-Implementation: Bitmask x and kk individually and add kk's value into register[x]
+Implementation: Add kk's value into register[x]
 */
-void Chip8::OP_7xkk(){
+void Chip8::OP_7xkk(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t x = instruction.x;
     
-    uint8_t kk = opcode & 0x00FFu;
+    uint8_t kk = instruction.kk;
 
     registers[x] += kk;
 }
@@ -342,13 +873,13 @@ void Chip8::OP_7xkk(){
 /*
 Opcode: 8xy0 (LD Vx, Vy)
 Functionality: Load register Vy's value into Vx
-Implementation: Bitmask x and y individually and set v[x] = v[y]
+Implementation: Set v[x] = v[y]
 */
-void Chip8::OP_8xy0(){
+void Chip8::OP_8xy0(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t x = instruction.x;
     
-    uint8_t y = (opcode & 0x00F0u) >> 4u;
+    uint8_t y = instruction.y;
 
     registers[x] = registers[y];
 }
@@ -356,13 +887,13 @@ void Chip8::OP_8xy0(){
 /*
 Opcode: 8xy1 (OR Vx, Vy)
 Functionality: Set Vx = Vx | Vy
-Implementation: Bitmask x and y individually and set v[x] = v[x] | v[y]
+Implementation: Set v[x] = v[x] | v[y]
 */
-void Chip8::OP_8xy1(){
+void Chip8::OP_8xy1(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t x = instruction.x;
     
-    uint8_t y = (opcode & 0x00F0u) >> 4u;
+    uint8_t y = instruction.y;
 
     registers[x] = registers[x] | registers[y];
 }
@@ -370,13 +901,13 @@ void Chip8::OP_8xy1(){
 /*
 Opcode: 8xy2 (AND Vx, Vy)
 Functionality: Set Vx = Vx & Vy
-Implementation: Bitmask x and y individually and set v[x] = v[x] & v[y]
+Implementation: Set v[x] = v[x] & v[y]
 */
-void Chip8::OP_8xy2(){
+void Chip8::OP_8xy2(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t x = instruction.x;
     
-    uint8_t y = (opcode & 0x00F0u) >> 4u;
+    uint8_t y = instruction.y;
 
     registers[x] = registers[x] & registers[y];
 }
@@ -384,13 +915,13 @@ void Chip8::OP_8xy2(){
 /*
 Opcode: 8xy3 (XOR Vx, Vy)
 Functionality: Set Vx = Vx ^ Vy
-Implementation: Bitmask x and y individually and set v[x] = v[x] ^ v[y]
+Implementation: Set v[x] = v[x] ^ v[y]
 */
-void Chip8::OP_8xy3(){
+void Chip8::OP_8xy3(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u)>>8u;
+    uint8_t x = instruction.x;
     
-    uint8_t y = (opcode & 0x00F0u)>>4u;
+    uint8_t y = instruction.y;
 
     registers[x] = registers[x] ^ registers[y];
 }
@@ -398,14 +929,14 @@ void Chip8::OP_8xy3(){
 /*
 Opcode: 8xy4 (ADD Vx, Vy)
 Functionality: Set Vx = Vx ^ Vy
-Implementation: Bitmask x and y individually and set v[x] = v[x] + v[y]
+Implementation: Set v[x] = v[x] + v[y]
 if total is bigger than 255, set VF to 1 and subtract/bitmask carry.
 */
-void Chip8::OP_8xy4(){
+void Chip8::OP_8xy4(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u)>>8u;
+    uint8_t x = instruction.x;
     
-    uint8_t y = (opcode & 0x00F0u)>>4u;
+    uint8_t y = instruction.y;
 
     uint32_t total = registers[x] + registers[y];
 
@@ -422,14 +953,14 @@ void Chip8::OP_8xy4(){
 /*
 Opcode: 8xy5 (SUB Vx, Vy)
 Functionality: Bitmask x and y individually and set v[x] = v[x] - v[y]
-Implementation: Bitmask x and y individually and set v[x] = v[x] - v[y]
+Implementation: Set v[x] = v[x] - v[y]
 if Vx is bigger than Vy, set V[16] to 1 and 0 otherwise.
 */
-void Chip8::OP_8xy5(){
+void Chip8::OP_8xy5(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u)>>8u;
+    uint8_t x = instruction.x;
     
-    uint8_t y = (opcode & 0x00F0u)>>4u;
+    uint8_t y = instruction.y;
 
     if (registers[x] > registers[y]){
         registers[0xF] = 1u;
@@ -445,11 +976,11 @@ void Chip8::OP_8xy5(){
 /*
 Opcode: 8xy6 (SHR Vx)
 Functionality: Vx >> 1; VF is set to 1 when Vx's LSB is 1. Div by 2.
-Implementation: use >> operator after bitmasking to get Vx
+Implementation: use >> operator on Vx
 */
-void Chip8::OP_8xy6(){
+void Chip8::OP_8xy6(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t x = instruction.x;
 
     // save LSB to VF
     registers[0xF] = (registers[x] & 0x1);
@@ -462,11 +993,11 @@ Opcode: 8xy7 (SUBN Vx, Vy)
 Functionality: Vx = Vy - Vx
 Implementation: same as 8xy5 but swap Vx and Vy
 */
-void Chip8::OP_8xy7(){
+void Chip8::OP_8xy7(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t x = instruction.x;
     
-    uint8_t y = (opcode & 0x00F0u) >> 4u;
+    uint8_t y = instruction.y;
 
     if (registers[x] < registers[y]){
         registers[0xF] = 1u;
@@ -483,9 +1014,9 @@ Opcode: 8xyE (SHL Vx)
 Functionality: Vx << 1; VF is set to 1 when Vx's LSB is 1. Mult by 2.
 Implementation: 
 */
-void Chip8::OP_8xyE(){
+void Chip8::OP_8xyE(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t x = instruction.x;
 
     // save LSB to VF
     registers[0xF] = registers[x] & 0x80u;
@@ -497,16 +1028,16 @@ void Chip8::OP_8xyE(){
 /*
 Opcode: 9xy0 (SNE, Vx, Vy)
 Functionality: Skip next instruction if Vx != Vy
-Implementation: Extract Vx and Vy using bitmasking and conditionally check them
+Implementation: Conditionally check Vx and Vy
 */
-void Chip8::OP_9xy0(){
+void Chip8::OP_9xy0(Instruction const& instruction){
 
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t x = instruction.x;
 
-    uint8_t y = (opcode & 0x00F0u) >> 4u;
+    uint8_t y = instruction.y;
 
     if(registers[x] != registers[y]){
-        pc += 2;
+        Skip();
     }
 }
 
@@ -515,9 +1046,9 @@ Opcode: ANNN (LD I, addr)
 Functionality: Load index register an addr nnn
 Implementation: 
 */
-void Chip8::OP_Annn(){
+void Chip8::OP_Annn(Instruction const& instruction){
 
-    uint16_t nnn = opcode & 0x0FFFu;
+    uint16_t nnn = instruction.nnn;
 
     index = nnn;
 }
@@ -527,9 +1058,9 @@ Opcode: Bnnn (JP V0, addr)
 Functionality: Jump to location nnn + V0
 Implementation: 
 */
-void Chip8::OP_Bnnn(){
+void Chip8::OP_Bnnn(Instruction const& instruction){
 
-    uint16_t nnn = opcode & 0x0FFFu;
+    uint16_t nnn = instruction.nnn;
     
     pc = nnn + registers[0];
 }
@@ -537,15 +1068,15 @@ void Chip8::OP_Bnnn(){
 /*
 Opcode: Cxkk (RND Vx, byte) 
 Functionality: Set Vx = random byte & kk
-Implementation: randomly generate using randByte
+Implementation: randomly generate using random
 */
-void Chip8::OP_Cxkk(){
+void Chip8::OP_Cxkk(Instruction const& instruction){
     
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t x = instruction.x;
 
-    uint8_t kk = opcode & 0x00FFu;
+    uint8_t kk = instruction.kk;
 
-    registers[x] = randByte(randGen) & kk;
+    registers[x] = random.Byte() & kk;
 
 }
 
@@ -554,60 +1085,206 @@ Opcode: DRW Vx, Vy, nibble
 Functionality: Display n-byte sprite starting at mem loc I at (Vx, Vy), set VF = collision.
 Implementation: 
 */
-void Chip8::OP_Dxyn(){
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
-    uint8_t y = (opcode & 0x00F0u) >> 4u;
-    uint8_t height = opcode & 0x000Fu;
-    // sprite is always 8 pixels (8 bits)
+void Chip8::OP_Dxyn(Instruction const& instruction){
+    uint8_t x = instruction.x;
+    uint8_t y = instruction.y;
+    uint8_t height = instruction.n;
+
+    registers[0xF] = DrawSprite(index, registers[x], registers[y], height);
+}
+
+/*
+ * Draws the height-byte sprite at memory[address] with its top left corner at (vx, vy).
+ * Shared by every engine. Returns 1 if any pixel was turned off (collision), otherwise 0.
+ * The start position wraps around the screen; the parts of the sprite that go past
+ * the right or bottom edge are clipped.
+ *
+ * On SCHIP and XO-CHIP, height 0 is a 16x16 sprite of two bytes per row. With several
+ * XO-CHIP planes selected, each plane takes the next sprite's worth of bytes.
+ */
+uint8_t Chip8::DrawSprite(uint16_t address, uint8_t vx, uint8_t vy, uint8_t height){
+    unsigned int width = 8;
+    if (height == 0 && variant != VARIANT_CHIP8){
+        width = 16;
+        height = 16;
+    }
 
     // modulo to video width/height to make it wrap around screen if off bounds
-    uint8_t xCoord = registers[x] % VIDEO_WIDTH;
-    uint8_t yCoord = registers[y] % VIDEO_HEIGHT;
-
-    // initialize VF as 0 for collision
-    registers[0xF] = 0; 
-
-    for(unsigned int row = 0; row < height; ++row)
-    {   
-        // each byte of sprite represents each row of sprite
-        uint8_t spriteByte = memory[index + row];
-
-        for(unsigned int col = 0; col < 8; ++col){
-            // spritepixel is pixel of the sprite at given column
-            // we don't need to bitshift spritePixel 
-            uint8_t spritePixel = spriteByte & (0x80u >> col);
-            // screenPixel represents pixel that is on the screen before sprite
-            // screenPixel is 32 bit pointer for ease of use for SDL
-            uint32_t* screenPixel = &video[(yCoord + row) * VIDEO_WIDTH + (xCoord + col)];
-
-            // if sprite pixel is on at a given position
-            if(spritePixel){
-                // and if screen pixel is also on on the same position, meaning collision
-                if (*screenPixel == 0xFFFFFFFF){
-                    // then mark VF as 1
-                    registers[0xF] = 1;
+    // (both are powers of two, so a mask does it)
+    unsigned int xCoord = vx & (VideoWidth() - 1);
+    unsigned int yCoord = vy & (VideoHeight() - 1);
+
+    // rows that are on screen
+    unsigned int rows = yCoord + height <= VideoHeight() ? height : VideoHeight() - yCoord;
+
+    // every pixel the sprite turned off
+    uint64_t collision = 0;
+
+    if (width == 8 && !hires && planes == 1){
+        // CHIP-8's own case, and the common one: plane 0, one byte per row, word 0 only
+        for (unsigned int row = 0; row < rows; ++row){
+            uint64_t spriteRow = (uint64_t)memory[(address + row) & memoryMask] << 56u >> xCoord;
+
+            collision |= video[0][yCoord + row][0] & spriteRow;
+            video[0][yCoord + row][0] ^= spriteRow;
+
+            if (spriteRow){
+                dirtyRows |= 1ULL << (yCoord + row);
+            }
+        }
+        return collision != 0;
+    }
+
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane){
+        if (!(planes & (1u << plane))){
+            continue;
+        }
+
+        for (unsigned int row = 0; row < rows; ++row){
+            // each byte (or pair of bytes) of sprite represents each row of sprite.
+            // Move it to column 0, then right to xCoord; pixels past the last column fall off.
+            uint64_t spriteRow = width == 8
+                ? (uint64_t)memory[(address + row) & memoryMask] << 56u
+                : (uint64_t)((memory[(address + 2 * row) & memoryMask] << 8u) | memory[(address + 2 * row + 1) & memoryMask]) << 48u;
+
+            // the part left of column 64 goes into word 0, the rest into word 1 (hi-res only)
+            uint64_t left = 0;
+            uint64_t right = 0;
+            if (xCoord < 64){
+                left = spriteRow >> xCoord;
+                if (hires && xCoord > 0){
+                    right = spriteRow << (64 - xCoord);
                 }
+            }
+            else{
+                right = spriteRow >> (xCoord - 64);
+            }
 
-                // XOR the sprite pixel with screen pixel to do cool stuff
-                *screenPixel = (*screenPixel) ^ 0xFFFFFFFF;
+            uint64_t* line = video[plane][yCoord + row];
+            // a pixel that is on in both collides
+            collision |= (line[0] & left) | (line[1] & right);
+            // XOR the sprite row with screen row to do cool stuff
+            line[0] ^= left;
+            line[1] ^= right;
+
+            if (left | right){
+                dirtyRows |= 1ULL << (yCoord + row);
             }
         }
+
+        // the next plane draws the following sprite
+        address += height * width / 8;
     }
 
+    return collision != 0;
+}
+
+void Chip8::ExpandVideo(uint64_t const video[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS], bool hires, uint32_t* pixels,
+                        unsigned int firstRow, unsigned int lastRow){
+    // RGBA by plane bits: off, plane 0, plane 1, both
+    static const uint32_t palette[1u << PLANE_COUNT] = { 0x00000000u, 0xFFFFFFFFu, 0xAAAAAAFFu, 0x555555FFu };
+    unsigned int width = hires ? HIRES_WIDTH : VIDEO_WIDTH;
+    unsigned int height = hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+    // a low-resolution pixel covers scale x scale texels
+    unsigned int scale = hires ? 1 : 2;
+
+    for (unsigned int y = firstRow; y <= lastRow && y < height; ++y){
+        uint32_t* out = &pixels[y * scale * HIRES_WIDTH];
+        for (unsigned int x = 0; x < width; ++x){
+            unsigned int word = x / 64;
+            unsigned int shift = 63 - x % 64;
+            unsigned int color = ((video[0][y][word] >> shift) & 1u) | (((video[1][y][word] >> shift) & 1u) << 1u);
+            for (unsigned int i = 0; i < scale; ++i){
+                out[x * scale + i] = palette[color];
+            }
+        }
+        if (scale == 2){
+            memcpy(out + HIRES_WIDTH, out, HIRES_WIDTH * sizeof(pixels[0]));
+        }
+    }
+}
+
+uint64_t Chip8::VideoHash() const{
+    // 64-bit FNV-1a over the visible words of every row, most significant byte first.
+    // Plane 1 is only hashed when something is on it, and word 1 only in hi-res.
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane){
+        if (plane > 0){
+            bool empty = true;
+            for (unsigned int y = 0; y < HIRES_HEIGHT && empty; ++y){
+                empty = (video[plane][y][0] | video[plane][y][1]) == 0;
+            }
+            if (empty){
+                continue;
+            }
+        }
+        for (unsigned int y = 0; y < VideoHeight(); ++y){
+            for (unsigned int word = 0; word < (hires ? ROW_WORDS : 1); ++word){
+                for (int shift = 56; shift >= 0; shift -= 8){
+                    hash ^= (video[plane][y][word] >> shift) & 0xFFu;
+                    hash *= 0x100000001b3ULL;
+                }
+            }
+        }
+    }
+    return hash;
+}
+
+bool Chip8::Halted() const{
+    // 1nnn jumping to itself; common "end of program" idiom
+    Instruction const& instruction = decoded[pc & memoryMask];
+    return (instruction.id == OPID_1nnn && instruction.nnn == pc) || instruction.id == OPID_00FD;
+}
+
+bool Chip8::Blocked() const{
+    if (decoded[pc & memoryMask].id != OPID_Fx0A){
+        return false;
+    }
+    for (unsigned int key = 0; key < KEY_COUNT; ++key){
+        if (keypad[key]){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Chip8::TakeDirtyRows(unsigned int& firstRow, unsigned int& lastRow){
+    // ClearScreen and the scrolls set every bit, and rows past the bottom stay marked after
+    // 00FE drops to low resolution, so keep only the rows of the current height
+    uint64_t rows = dirtyRows;
+    if (VideoHeight() < 64){
+        rows &= (1ULL << VideoHeight()) - 1;
+    }
+    dirtyRows = 0;
+
+    if (rows == 0){
+        return false;
+    }
+
+    firstRow = 0;
+    while (!(rows & (1ULL << firstRow))){
+        ++firstRow;
+    }
+    lastRow = VideoHeight() - 1;
+    while (!(rows & (1ULL << lastRow))){
+        --lastRow;
+    }
+    return true;
 }
 
 /*
 Opcode: Ex9E (SKP Vx) 
 Functionality: Skip next instruction if key with the value of Vx is pressed
-Implementation: decrement PC by 2 if no key is pressed (which just creates an infinite loop)
+Implementation: decrement PC by 2 if no key is pressed (which just creates an infinite loop).
+A value of 16 or more names no key, so it is never pressed.
 */
-void Chip8::OP_Ex9E(){
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Ex9E(Instruction const& instruction){
+    uint8_t x = instruction.x;
 
     uint8_t key = registers[x];
 
-    if(keypad[key]){
-        pc += 2;
+    if(key < KEY_COUNT && keypad[key]){
+        Skip();
     }
 
 }
@@ -617,13 +1294,13 @@ Opcode: ExA1 (SKNP Vx)
 Functionality: Skip next instruction if key with the value of Vx is NOT pressed
 Implementation: 
 */
-void Chip8::OP_ExA1(){
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_ExA1(Instruction const& instruction){
+    uint8_t x = instruction.x;
 
     uint8_t key = registers[x];
 
-    if(!keypad[key]){
-        pc += 2;
+    if(!(key < KEY_COUNT && keypad[key])){
+        Skip();
     }
 }
 
@@ -632,8 +1309,8 @@ Opcode: Fx07 (LD Vx, DT)
 Functionality: set Vx as value of delay timer
 Implementation: 
 */
-void Chip8::OP_Fx07(){
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx07(Instruction const& instruction){
+    uint8_t x = instruction.x;
 
     registers[x] = delayTimer;
 }
@@ -641,61 +1318,25 @@ void Chip8::OP_Fx07(){
 /*
 Opcode: Fx0A (LD, Vx, k)
 Functionality: Wati for keypress and store that value in Vx
-Implementation: 
+Implementation: Instead of re-executing itself until a key shows up, a blocked
+Fx0A ends the current Run (see Chip8::Blocked)
 */
-void Chip8::OP_Fx0A(){
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx0A(Instruction const& instruction){
+    uint8_t x = instruction.x;
 
-    if (keypad[0]){
-        registers[x] = 0;
-    }
-    else if (keypad[1]){
-        registers[x] = 1;
-    }
-    else if (keypad[2]){
-        registers[x] = 2;
-    }
-    else if (keypad[3]){
-        registers[x] = 3;
-    }
-    else if (keypad[4]){
-        registers[x] = 4;
-    }
-    else if (keypad[5]){
-        registers[x] = 5;
-    }
-    else if (keypad[6]){
-        registers[x] = 6;
-    }
-    else if (keypad[7]){
-        registers[x] = 7;
+    // lowest pressed key wins
+    unsigned int key = 0;
+    while (key < KEY_COUNT && !keypad[key]){
+        ++key;
     }
-    else if (keypad[8]){
-        registers[x] = 8;
-    }
-    else if (keypad[9]){
-        registers[x] = 9; 
-    }
-    else if (keypad[10]){
-        registers[x] = 10;
-    }
-    else if (keypad[11]){
-        registers[x] = 11;
-    }
-    else if (keypad[12]){
-        registers[x] = 12;
-    }
-    else if (keypad[13]){
-        registers[x] = 13;
-    }
-    else if (keypad[14]){
-        registers[x] = 14;
-    }
-    else if (keypad[15]){
-        registers[x] = 15;
+
+    if (key < KEY_COUNT){
+        registers[x] = key;
     }
     else{
+        // stay on this instruction; Run() stops here until a key is pressed
         pc -= 2;
+        keyWait = true;
     }
 }
 
@@ -704,8 +1345,8 @@ Opcode: Fx15 (LD DT, Vx)
 Functionality: set delay timer as Vx
 Implementation: 
 */
-void Chip8::OP_Fx15(){
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx15(Instruction const& instruction){
+    uint8_t x = instruction.x;
 
     delayTimer = registers[x];
 }
@@ -715,8 +1356,8 @@ Opcode: Fx18 (LD ST, Vx)
 Functionality: set sound timer as Vx
 Implementation: 
 */
-void Chip8::OP_Fx18(){
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx18(Instruction const& instruction){
+    uint8_t x = instruction.x;
 
     soundTimer = registers[x];
 }
@@ -726,8 +1367,8 @@ Opcode: Fx1E (ADD I, Vx)
 Functionality: set I = I + Vx
 Implementation: 
 */
-void Chip8::OP_Fx1E(){
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx1E(Instruction const& instruction){
+    uint8_t x = instruction.x;
 
     index += registers[x];
 }
@@ -737,8 +1378,8 @@ Opcode: Fx29 (LD F, Vx)
 Functionality: set I as location of sprite for digit Vx
 Implementation: 
 */
-void Chip8::OP_Fx29(){
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx29(Instruction const& instruction){
+    uint8_t x = instruction.x;
     uint8_t num = registers[x];
 
     index = FONTSET_START_ADDRESS + (5 * num);
@@ -749,17 +1390,20 @@ Opcode: Fx33 (LD B, Vx)
 Functionality: Store BCD rep of Vx (0~255) in mem loc I (1e2), I+1 (1e1), and I+x (1e0)
 Implementation: modulo 10 to extract smallest digit, store that, and divide 10 again.
 */
-void Chip8::OP_Fx33(){
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx33(Instruction const& instruction){
+    uint8_t x = instruction.x;
     uint8_t num = registers[x];
 
-    memory[index+2] = num % 10;
+    memory[(index + 2) & memoryMask] = num % 10;
     num /= 10;
 
-    memory[index+1] = num % 10;
+    memory[(index + 1) & memoryMask] = num % 10;
     num /= 10;
 
-    memory[index] = num % 10;
+    memory[index & memoryMask] = num % 10;
+
+    // the digits may have been written over code
+    Predecode(index, 3);
 }
 
 /*
@@ -767,12 +1411,15 @@ Opcode: Fx55 (LD [I], Vx)
 Functionality: Store registers V0 through Vx in mem starting at loc I
 Implementation: 
 */
-void Chip8::OP_Fx55(){
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx55(Instruction const& instruction){
+    uint8_t x = instruction.x;
 
     for(uint8_t i = 0; i <= x; ++i){
-        memory[index + i] = registers[x];
+        memory[(index + i) & memoryMask] = registers[i];
     }
+
+    // the registers may have been written over code
+    Predecode(index, x + 1);
 }
 
 /*
@@ -780,10 +1427,185 @@ Opcode: Fx65 (LD Vx, [I])
 Functionality: Load registers V0 through Vx into mem starting at loc I
 Implementation: 
 */
-void Chip8::OP_Fx65(){
-    uint8_t x = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx65(Instruction const& instruction){
+    uint8_t x = instruction.x;
+
+    for(uint8_t i = 0; i <= x; ++i){
+        registers[i] = memory[(index + i) & memoryMask];
+    }
+}
+
+/*
+Opcode: 00Cn (SCD n)
+Functionality: Scroll the display down by n rows (SCHIP)
+Implementation: Move the packed rows of the selected planes; rows are of the current resolution
+*/
+void Chip8::OP_00Cn(Instruction const& instruction){
+    ScrollRows(instruction.n);
+}
+
+/*
+Opcode: 00Dn (SCU n)
+Functionality: Scroll the display up by n rows (XO-CHIP)
+Implementation: Same as 00Cn the other way
+*/
+void Chip8::OP_00Dn(Instruction const& instruction){
+    ScrollRows(-(int)instruction.n);
+}
+
+/*
+Opcode: 00FB (SCR)
+Functionality: Scroll the display right by 4 pixels (SCHIP)
+Implementation: Shift both words of every row
+*/
+void Chip8::OP_00FB(Instruction const& instruction){
+    ScrollColumns(4);
+}
+
+/*
+Opcode: 00FC (SCL)
+Functionality: Scroll the display left by 4 pixels (SCHIP)
+Implementation: Same as 00FB the other way
+*/
+void Chip8::OP_00FC(Instruction const& instruction){
+    ScrollColumns(-4);
+}
+
+/*
+Opcode: 00FD (EXIT)
+Functionality: Stop the interpreter (SCHIP)
+Implementation: Stay on this instruction forever, which Halted() reports
+*/
+void Chip8::OP_00FD(Instruction const& instruction){
+    pc -= 2;
+}
+
+/*
+Opcode: 00FE (LOW) / 00FF (HIGH)
+Functionality: Switch to 64 x 32 / 128 x 64 pixels (SCHIP)
+Implementation: Blank every plane, so nothing outside the new resolution is left on
+*/
+void Chip8::OP_00FE(Instruction const& instruction){
+    hires = false;
+    memset(video, 0, sizeof(video));
+    dirtyRows = ~0ULL;
+}
+
+void Chip8::OP_00FF(Instruction const& instruction){
+    hires = true;
+    memset(video, 0, sizeof(video));
+    dirtyRows = ~0ULL;
+}
+
+/*
+Opcode: Fx30 (LD HF, Vx)
+Functionality: set I as location of the 8x10 sprite for digit Vx (SCHIP)
+Implementation: Same as Fx29 with the big font
+*/
+void Chip8::OP_Fx30(Instruction const& instruction){
+    uint8_t x = instruction.x;
+    uint8_t num = registers[x] & 0xFu;
+
+    index = BIGFONT_START_ADDRESS + (10 * num);
+}
+
+/*
+Opcode: Fx75 (LD R, Vx)
+Functionality: Store registers V0 through Vx in the user flags (SCHIP)
+Implementation: 
+*/
+void Chip8::OP_Fx75(Instruction const& instruction){
+    uint8_t x = instruction.x;
 
     for(uint8_t i = 0; i <= x; ++i){
-        registers[i] = memory[index + i];
+        flags[i] = registers[i];
     }
-}
\ No newline at end of file
+}
+
+/*
+Opcode: Fx85 (LD Vx, R)
+Functionality: Load registers V0 through Vx from the user flags (SCHIP)
+Implementation: 
+*/
+void Chip8::OP_Fx85(Instruction const& instruction){
+    uint8_t x = instruction.x;
+
+    for(uint8_t i = 0; i <= x; ++i){
+        registers[i] = flags[i];
+    }
+}
+
+/*
+Opcode: 5xy2 (SAVE Vx - Vy)
+Functionality: Store registers Vx through Vy (in either direction) in mem starting at loc I, leaving I alone (XO-CHIP)
+Implementation: 
+*/
+void Chip8::OP_5xy2(Instruction const& instruction){
+    uint8_t x = instruction.x;
+    uint8_t y = instruction.y;
+    unsigned int count = (x < y ? y - x : x - y) + 1;
+
+    for(unsigned int i = 0; i < count; ++i){
+        memory[(index + i) & memoryMask] = registers[x < y ? x + i : x - i];
+    }
+
+    // the registers may have been written over code
+    Predecode(index, count);
+}
+
+/*
+Opcode: 5xy3 (LOAD Vx - Vy)
+Functionality: Load registers Vx through Vy (in either direction) from mem starting at loc I (XO-CHIP)
+Implementation: 
+*/
+void Chip8::OP_5xy3(Instruction const& instruction){
+    uint8_t x = instruction.x;
+    uint8_t y = instruction.y;
+    unsigned int count = (x < y ? y - x : x - y) + 1;
+
+    for(unsigned int i = 0; i < count; ++i){
+        registers[x < y ? x + i : x - i] = memory[(index + i) & memoryMask];
+    }
+}
+
+/*
+Opcode: F000 nnnn (LD I, long)
+Functionality: Load the 16-bit address in the next two bytes into I (XO-CHIP)
+Implementation: The only 4-byte instruction; PC already points at nnnn, so read it and step over it.
+Skips step over it too (see Skip)
+*/
+void Chip8::OP_F000(Instruction const& instruction){
+    index = (memory[pc & memoryMask] << 8u) | memory[(pc + 1) & memoryMask];
+    pc += 2;
+}
+
+/*
+Opcode: Fn01 (PLANE n)
+Functionality: Select the planes that drawing, clearing and scrolling work on (XO-CHIP)
+Implementation: n is a bitmask of the two planes
+*/
+void Chip8::OP_Fx01(Instruction const& instruction){
+    planes = instruction.x & ((1u << PLANE_COUNT) - 1);
+}
+
+/*
+Opcode: F002 (AUDIO)
+Functionality: Load 16 bytes of 1-bit audio samples from mem loc I (XO-CHIP)
+Implementation: 
+*/
+void Chip8::OP_F002(Instruction const& instruction){
+    for(unsigned int i = 0; i < AUDIO_PATTERN_SIZE; ++i){
+        audioPattern[i] = memory[(index + i) & memoryMask];
+    }
+}
+
+/*
+Opcode: Fx3A (PITCH Vx)
+Functionality: Set the playback rate of the audio pattern (XO-CHIP)
+Implementation: 
+*/
+void Chip8::OP_Fx3A(Instruction const& instruction){
+    uint8_t x = instruction.x;
+
+    pitch = registers[x];
+}
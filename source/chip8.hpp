@@ -1,114 +1,421 @@
 #pragma once 
 
+#include <cstddef>
 #include <cstdint>
-#include <random>
+#include <memory>
+#include "random.hpp"
 
 const unsigned int KEY_COUNT = 16;
+// memory of CHIP-8 and SCHIP
 const unsigned int MEMORY_SIZE = 4096;
+// memory of XO-CHIP
+const unsigned int XO_MEMORY_SIZE = 0x10000;
 const unsigned int REGISTER_COUNT = 16;
 const unsigned int STACK_LEVEL = 16;
+// low-resolution display, the only one of CHIP-8
 const unsigned int VIDEO_HEIGHT = 32;
 const unsigned int VIDEO_WIDTH = 64;
+// high-resolution display of SCHIP and XO-CHIP (00FF)
+const unsigned int HIRES_HEIGHT = 64;
+const unsigned int HIRES_WIDTH = 128;
+// 64-bit words in one packed display row, enough for HIRES_WIDTH pixels
+const unsigned int ROW_WORDS = HIRES_WIDTH / 64;
+// XO-CHIP bitplanes; CHIP-8 and SCHIP only draw on the first
+const unsigned int PLANE_COUNT = 2;
+// bytes of the XO-CHIP audio pattern (F002)
+const unsigned int AUDIO_PATTERN_SIZE = 16;
+const unsigned int START_ADDRESS = 0x200;
+const unsigned int FONTSET_SIZE = 80;
+const unsigned int FONTSET_START_ADDRESS = 0x50;
+// SCHIP 8x10 digits (Fx30), right after the small font
+const unsigned int BIGFONT_SIZE = 160;
+const unsigned int BIGFONT_START_ADDRESS = FONTSET_START_ADDRESS + FONTSET_SIZE;
+
+class Analysis;
+class Jit;
+class Lockstep;
+class Profile;
+class Trace;
+struct Chip8State;
+
+// Identifies an instruction handler. Used as an index into Chip8's handler table.
+enum OpId : uint8_t{
+    OPID_NULL,
+    OPID_00E0,
+    OPID_00EE,
+    OPID_1nnn,
+    OPID_2nnn,
+    OPID_3xkk,
+    OPID_4xkk,
+    OPID_5xy0,
+    OPID_6xkk,
+    OPID_7xkk,
+    OPID_8xy0,
+    OPID_8xy1,
+    OPID_8xy2,
+    OPID_8xy3,
+    OPID_8xy4,
+    OPID_8xy5,
+    OPID_8xy6,
+    OPID_8xy7,
+    OPID_8xyE,
+    OPID_9xy0,
+    OPID_Annn,
+    OPID_Bnnn,
+    OPID_Cxkk,
+    OPID_Dxyn,
+    OPID_Ex9E,
+    OPID_ExA1,
+    OPID_Fx07,
+    OPID_Fx0A,
+    OPID_Fx15,
+    OPID_Fx18,
+    OPID_Fx1E,
+    OPID_Fx29,
+    OPID_Fx33,
+    OPID_Fx55,
+    OPID_Fx65,
+    // SCHIP
+    OPID_00Cn,
+    OPID_00FB,
+    OPID_00FC,
+    OPID_00FD,
+    OPID_00FE,
+    OPID_00FF,
+    OPID_Fx30,
+    OPID_Fx75,
+    OPID_Fx85,
+    // XO-CHIP
+    OPID_00Dn,
+    OPID_5xy2,
+    OPID_5xy3,
+    OPID_F000,
+    OPID_Fx01,
+    OPID_F002,
+    OPID_Fx3A,
+    OPID_COUNT
+};
+
+// Instruction sets selectable with Chip8::SetVariant. Each one adds to the one before.
+enum Variant : uint8_t{
+    // the original: 64x32 display, 4 KB of memory
+    VARIANT_CHIP8,
+    // SUPER-CHIP 1.1: 128x64 mode, scrolling, 16x16 sprites, big digits, flag registers
+    VARIANT_SCHIP,
+    // XO-CHIP: 64 KB of memory with F000 nnnn, two bitplanes, scrolling up, audio pattern and pitch
+    VARIANT_XOCHIP
+};
+
+// Execution engines selectable with Chip8::SetEngine
+enum Engine{
+    // Cycle(): one handler call per instruction through the function pointer table
+    ENGINE_TABLE,
+    // RunThreaded(): one function, threaded dispatch, machine state in locals
+    ENGINE_THREADED,
+    // Jit::Run(): basic blocks recompiled to x86-64, interpreter for the rest
+    ENGINE_JIT
+};
+
+// An opcode with its handler looked up and its fields extracted ahead of time
+struct Instruction{
+    // OpId of the handler
+    uint8_t id;
+    // second digit: register Vx
+    uint8_t x;
+    // third digit: register Vy
+    uint8_t y;
+    // last digit: nibble
+    uint8_t n;
+    // lower byte: immediate
+    uint8_t kk;
+    // lower 12 bits: address
+    uint16_t nnn;
+};
 
 class Chip8{
     public:
-        //constructor for the emulator
+        //constructor for the emulator; Cxkk is seeded from the clock, so every run differs
         Chip8();
-        void LoadROM(char const* filename);
+        // same, but Cxkk produces the same bytes for the same seed
+        explicit Chip8(uint64_t seed);
+        ~Chip8();
+        // returns false if the ROM file could not be opened
+        bool LoadROM(char const* filename);
+        // same, from a ROM image already in memory; returns false if it does not fit
+        bool LoadROM(uint8_t const* data, size_t size);
+        // restart the Cxkk sequence; the same seed and the same input give a bit-identical run
+        void Seed(uint64_t seed){ random.Seed(seed); }
+        // execute a single instruction; timers are not touched (see TickTimers)
         void Cycle();
+        // execute `count` instructions with the selected engine; returns number executed. Once Fx0A
+        // is waiting for a key, the rest of the budget is spent waiting without executing anything,
+        // and idle loops are fast-forwarded (see SetIdleSkip).
+        unsigned int Run(unsigned int count);
+        // count delay and sound timers down by one; call at 60 Hz of emulated time
+        void TickTimers();
+
+        // Run() recognizes short loops that only wait for the delay timer or the keypad (or jump to
+        // themselves) and skips their remaining iterations up to the end of the budget. The result
+        // is identical either way; tracing always runs every instruction. On by default.
+        void SetIdleSkip(bool enabled){ idleSkip = enabled; }
+        bool IdleSkip() const { return idleSkip; }
+        // instructions Run() skipped inside idle loops so far
+        uint64_t SkippedInstructions() const { return skippedInstructions; }
+
+        // instruction set, memory size and display modes; CHIP-8 by default. Call before LoadROM:
+        // it redecodes memory and, for SCHIP and XO-CHIP, writes the big font into it.
+        void SetVariant(Variant variant);
+        Variant GetVariant() const { return variant; }
+        // "chip8", "schip" or "xochip"; returns false for an unknown name
+        static bool VariantFromName(char const* name, Variant& variant);
+        static char const* VariantName(Variant variant);
+
+        void SetEngine(Engine engine);
+        Engine GetEngine() const { return engine; }
+        // "table", "threaded" or "jit"; returns false for an unknown name
+        static bool EngineFromName(char const* name, Engine& engine);
+        static char const* EngineName(Engine engine);
+        // do the selected engine's per-block work for the blocks found by a static analysis of
+        // memory now rather than on first execution; call after LoadROM and SetEngine (see analysis.hpp)
+        void Pretranslate(Analysis const& analysis);
+
+        // bytes SaveState writes: a Chip8State and MemorySize() bytes of memory after it
+        size_t StateSize() const;
+        // copy the whole machine (including keypad and random engine) into state, which must have
+        // room for StateSize() bytes; see savestate.hpp
+        void SaveState(Chip8State& state) const;
+        // resume from state; returns false (and changes nothing) if it has the wrong magic or version,
+        // memory of another size than its variant's, or planes or a random state no machine can reach
+        bool LoadState(Chip8State const& state);
+
+        // look up the handler of an opcode and split it into fields
+        Instruction Decode(uint16_t opcode) const;
+
+        // start recording every executed instruction into a ring buffer holding the last `capacity` of them.
+        // Build with -DCHIP8_NO_TRACE to remove the check from Cycle() entirely.
+        Trace& EnableTrace(size_t capacity);
+        // start counting executions per opcode and per address, Dxyn time and Fx0A waits (see profile.hpp).
+        // Like tracing this runs on the table engine. Build with -DCHIP8_NO_PROFILE to remove the check from Cycle().
+        Profile& EnableProfile();
 
         // input arrays
         uint8_t keypad[KEY_COUNT]{};
-        // memory for display (64 x 32)
-        uint32_t video[VIDEO_WIDTH * VIDEO_HEIGHT]{};
+        // memory for display, one bit per pixel and one bitplane per XO-CHIP plane: video[p][y]
+        // holds row y of plane p, with columns 0-63 in word 0 and 64-127 in word 1, leftmost
+        // column in the most significant bit. In low resolution only word 0 of rows 0-31 is
+        // used; everything outside the current resolution is always 0.
+        uint64_t video[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS]{};
+
+        // true in SCHIP/XO-CHIP high resolution (128 x 64), false in 64 x 32
+        bool Hires() const { return hires; }
+        unsigned int VideoWidth() const { return hires ? HIRES_WIDTH : VIDEO_WIDTH; }
+        unsigned int VideoHeight() const { return hires ? HIRES_HEIGHT : VIDEO_HEIGHT; }
+
+        // write rows firstRow..lastRow of a display laid out like `video` into a HIRES_WIDTH * HIRES_HEIGHT
+        // RGBA buffer; a low-resolution pixel becomes 2 x 2, so its rows land at 2 * firstRow..2 * lastRow + 1.
+        // Plane 0 alone is white, plane 1 alone light grey, both dark grey, neither 0. Static so a copy of
+        // video can be expanded on another thread.
+        static void ExpandVideo(uint64_t const video[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS], bool hires, uint32_t* pixels,
+                                unsigned int firstRow = 0, unsigned int lastRow = HIRES_HEIGHT - 1);
+        // rows changed by drawing, clearing or scrolling since the last call; returns false (and
+        // leaves the arguments alone) if nothing changed
+        bool TakeDirtyRows(unsigned int& firstRow, unsigned int& lastRow);
+        // FNV-1a hash of the display, for comparing runs without keeping framebuffers. A
+        // low-resolution display on plane 0 alone hashes as it did before SCHIP support.
+        uint64_t VideoHash() const;
+        // true if the next instruction is a jump to itself or SCHIP's 00FD (exit), so nothing
+        // will ever change again (apart from the timers)
+        bool Halted() const;
+        // true if the next instruction is Fx0A and no key is pressed: nothing but the timers
+        // changes until a key is, so Run() returns at once and the caller may wait for input
+        bool Blocked() const;
+        // the buzzer sounds while the sound timer is nonzero; XO-CHIP programs can replace its
+        // tone with the 128 1-bit samples loaded by F002, played at the rate set by Fx3A
+        uint8_t SoundTimer() const { return soundTimer; }
+        uint8_t const* AudioPattern() const { return audioPattern; }
+        uint8_t Pitch() const { return pitch; }
 
     private:
-        // random engine is called randGen
-        std::default_random_engine randGen;
-        // randByte will be used as seed
-        std::uniform_int_distribution<uint8_t> randByte;
+        // generated code reads and writes the machine state below directly
+        friend class Jit;
+        // copies memory and decoded as the starting image of its lanes
+        friend class Lockstep;
+        // reads memory and decoded to build the control-flow graph
+        friend class Analysis;
+
+        // source of Cxkk's random bytes
+        Random random;
+        // null unless EnableTrace was called
+        std::unique_ptr<Trace> trace;
+        // null unless EnableProfile was called
+        std::unique_ptr<Profile> profile;
+        Engine engine{ENGINE_TABLE};
+        // created by SetEngine(ENGINE_JIT)
+        std::unique_ptr<Jit> jit;
+
+        // Cycle()'s execute step while profiling; see profile.cpp
+        void ExecuteProfiled(uint16_t address, Instruction const& instruction);
+        // threaded-code engine; see threaded.cpp
+        unsigned int RunThreaded(unsigned int count);
+        // XOR a sprite onto the display; returns 1 on collision. Shared by all engines.
+        uint8_t DrawSprite(uint16_t address, uint8_t vx, uint8_t vy, uint8_t height);
+        // blank the selected planes. Shared by all engines.
+        void ClearScreen();
+        // move the selected planes down (distance > 0) or up by whole rows, or right (distance > 0)
+        // or left by columns; pixels moved off the display are lost and blanks come in
+        void ScrollRows(int distance);
+        void ScrollColumns(int distance);
+        // pc += 2 for a taken skip, or 4 if it skips an XO-CHIP F000 nnnn
+        void Skip(){ pc += decoded[pc & memoryMask].id == OPID_F000 ? 4 : 2; }
+        // bit y is set if row y of video changed since the last TakeDirtyRows
+        uint64_t dirtyRows{};
+
+        Variant variant{VARIANT_CHIP8};
+        // MemorySize() - 1; pc and fetches wrap with it
+        uint16_t memoryMask{MEMORY_SIZE - 1};
+        unsigned int MemorySize() const { return memoryMask + 1u; }
+        // set memoryMask, the size of memory and the decode table entries that depend on variant.
+        // Memory keeps the bytes that still fit; decoded has to be refreshed with Predecode.
+        void ApplyVariant();
+        // high resolution; switched by 00FE/00FF
+        bool hires{};
+        // bit p set if Dxyn, 00E0 and the scrolls work on plane p; set by XO-CHIP's Fn01
+        uint8_t planes{1};
+        // SCHIP's RPL user flags (Fx75/Fx85)
+        uint8_t flags[REGISTER_COUNT]{};
+        // XO-CHIP sound: 1-bit samples loaded by F002 and their playback rate set by Fx3A
+        uint8_t audioPattern[AUDIO_PATTERN_SIZE]{};
+        uint8_t pitch{64};
+        // set by Fx0A when it found no key; tells the engines to give up the rest of the budget.
+        // Cleared at the start of every Run.
+        bool keyWait{};
+        // report instructions spent waiting in Fx0A to the profile, if any
+        void CountBlocked(unsigned int instructions);
+
+        bool idleSkip{true};
+        uint64_t skippedInstructions{};
+        // up to `count` instructions with the selected engine
+        unsigned int RunEngine(unsigned int count);
+        // true if a backward 1nnn closes a loop of at most MAX_IDLE_LOOP instructions around pc
+        bool NearIdleLoop() const;
+        // run one iteration of the loop at pc (at most `count` instructions); if it had no side
+        // effects and left the machine as it found it, skip whole iterations of the rest of count.
+        // Returns instructions executed plus skipped.
+        unsigned int SkipIdleLoop(unsigned int count);
         
         // NULL
-        void OP_NULL();
+        void OP_NULL(Instruction const& instruction);
         // CLS
-        void OP_00E0();
+        void OP_00E0(Instruction const& instruction);
         // RET
-        void OP_00EE();
+        void OP_00EE(Instruction const& instruction);
         // JP
-        void OP_1nnn();
+        void OP_1nnn(Instruction const& instruction);
         // CALL
-        void OP_2nnn();
+        void OP_2nnn(Instruction const& instruction);
         // SE (immediate)
-        void OP_3xkk();
+        void OP_3xkk(Instruction const& instruction);
         // SNE (immediate)
-        void OP_4xkk();
+        void OP_4xkk(Instruction const& instruction);
         // SE (register)
-        void OP_5xy0();
+        void OP_5xy0(Instruction const& instruction);
         // LD (immediate)
-        void OP_6xkk();
+        void OP_6xkk(Instruction const& instruction);
         // ADD (immediate)
-        void OP_7xkk();
+        void OP_7xkk(Instruction const& instruction);
         // LD (register)
-        void OP_8xy0();
+        void OP_8xy0(Instruction const& instruction);
         // OR (register)
-        void OP_8xy1();
+        void OP_8xy1(Instruction const& instruction);
         // AND (register)
-        void OP_8xy2();
+        void OP_8xy2(Instruction const& instruction);
         // XOR (register)
-        void OP_8xy3();
+        void OP_8xy3(Instruction const& instruction);
         // ADD (register)
-        void OP_8xy4();
+        void OP_8xy4(Instruction const& instruction);
         // SUB (register)
-        void OP_8xy5();    
+        void OP_8xy5(Instruction const& instruction);    
         // SHR
-        void OP_8xy6();
+        void OP_8xy6(Instruction const& instruction);
         // SUBN
-        void OP_8xy7();
+        void OP_8xy7(Instruction const& instruction);
         // SHL
-        void OP_8xyE();
+        void OP_8xyE(Instruction const& instruction);
         // SNE
-        void OP_9xy0();
+        void OP_9xy0(Instruction const& instruction);
         // LD I (immediate)
-        void OP_Annn();
+        void OP_Annn(Instruction const& instruction);
         // JP (register)
-        void OP_Bnnn();
+        void OP_Bnnn(Instruction const& instruction);
         // RND (immediate)
-        void OP_Cxkk();
+        void OP_Cxkk(Instruction const& instruction);
         // Dxyn
-        void OP_Dxyn();
+        void OP_Dxyn(Instruction const& instruction);
         // Ex9E
-        void OP_Ex9E();
+        void OP_Ex9E(Instruction const& instruction);
         // ExA1
-        void OP_ExA1();
+        void OP_ExA1(Instruction const& instruction);
         // Fx07
-        void OP_Fx07();
+        void OP_Fx07(Instruction const& instruction);
         // Fx0A
-        void OP_Fx0A();
+        void OP_Fx0A(Instruction const& instruction);
         // Fx15
-        void OP_Fx15();
+        void OP_Fx15(Instruction const& instruction);
         // Fx18
-        void OP_Fx18();
+        void OP_Fx18(Instruction const& instruction);
         // Fx1E
-        void OP_Fx1E();
+        void OP_Fx1E(Instruction const& instruction);
         // Fx29
-        void OP_Fx29();
+        void OP_Fx29(Instruction const& instruction);
         // Fx33
-        void OP_Fx33();
+        void OP_Fx33(Instruction const& instruction);
         // Fx55
-        void OP_Fx55();
+        void OP_Fx55(Instruction const& instruction);
         // Fx65
-        void OP_Fx65();
+        void OP_Fx65(Instruction const& instruction);
 
-        void Tb0();
-        void Tb8();
-        void TbE();
-        void TbF();
+        // SCD n (SCHIP)
+        void OP_00Cn(Instruction const& instruction);
+        // SCR (SCHIP)
+        void OP_00FB(Instruction const& instruction);
+        // SCL (SCHIP)
+        void OP_00FC(Instruction const& instruction);
+        // EXIT (SCHIP)
+        void OP_00FD(Instruction const& instruction);
+        // LOW (SCHIP)
+        void OP_00FE(Instruction const& instruction);
+        // HIGH (SCHIP)
+        void OP_00FF(Instruction const& instruction);
+        // LD HF, Vx (SCHIP)
+        void OP_Fx30(Instruction const& instruction);
+        // LD R, Vx (SCHIP)
+        void OP_Fx75(Instruction const& instruction);
+        // LD Vx, R (SCHIP)
+        void OP_Fx85(Instruction const& instruction);
+        // SCU n (XO-CHIP)
+        void OP_00Dn(Instruction const& instruction);
+        // SAVE Vx - Vy (XO-CHIP)
+        void OP_5xy2(Instruction const& instruction);
+        // LOAD Vx - Vy (XO-CHIP)
+        void OP_5xy3(Instruction const& instruction);
+        // LD I, long (XO-CHIP)
+        void OP_F000(Instruction const& instruction);
+        // PLANE n (XO-CHIP)
+        void OP_Fx01(Instruction const& instruction);
+        // AUDIO (XO-CHIP)
+        void OP_F002(Instruction const& instruction);
+        // PITCH Vx (XO-CHIP)
+        void OP_Fx3A(Instruction const& instruction);
+
+        // refresh the decoded instructions overlapping memory[address, address + length)
+        // and drop JIT translations of it
+        void Predecode(unsigned int address, unsigned int length);
 
         /* Data Structure for Chip8 class */
         // 15 general registers, 16th register is used to hold flag about operation results
         uint8_t registers[REGISTER_COUNT]{};
-        // memory is 4k bits
-        uint8_t memory[MEMORY_SIZE]{};
+        // memory is 4k bits (64k for XO-CHIP); MemorySize() bytes in memoryStorage
+        uint8_t* memory{};
         // Index register store memory addresses for use in operations; LC-3 equivalent of MAR but not rlly
         uint16_t index{};
         // Program counter
@@ -121,17 +428,29 @@ class Chip8{
         uint8_t delayTimer{};
         // same as above but for sound. Decrements in 60Hz if non-zero
         uint8_t soundTimer{};
-        // opcodes!
-        uint16_t opcode;
+        // decoded[addr] is the instruction starting at memory[addr]. Kept in sync with memory by
+        // Predecode, so Cycle() never has to fetch or decode. MemorySize() of them in decodedStorage.
+        Instruction* decoded{};
+        // the arrays behind memory and decoded, allocated by ApplyVariant, so that only an
+        // XO-CHIP machine carries 64 KB of memory and 64 K decoded instructions
+        std::unique_ptr<uint8_t[]> memoryStorage;
+        std::unique_ptr<Instruction[]> decodedStorage;
 
         //declare pointer to function for function pointer array action
-        typedef void (Chip8::*Chip8Func)();
+        typedef void (Chip8::*Chip8Func)(Instruction const& instruction);
+        // handler for every OpId
+        static const Chip8Func handlers[OPID_COUNT];
+
+        // Decode tables: map digits of an opcode to an OpId.
         // I think these have problems where it cannot handle erroneous pointer value? Or since this is class its constructor will buidl OP_NULL for everything...?
         // I emailed Austin Morlan (whom I referenced the emaultor from) and he agreed, so this issue is fixed now!
-        Chip8Func table[0xF + 1];
-        Chip8Func table0[0xE + 1];
-        Chip8Func table8[0xE + 1];
-        Chip8Func tableE[0xE + 1];
-        Chip8Func tableF[0x65 + 1];
+        uint8_t table[0xF + 1];
+        // keyed by the last two digits, since SCHIP's 00Cn/00FB.. need both
+        uint8_t table0[0xFF + 1];
+        // keyed by the last digit, for XO-CHIP's 5xy2/5xy3
+        uint8_t table5[0xF + 1];
+        uint8_t table8[0xE + 1];
+        uint8_t tableE[0xE + 1];
+        uint8_t tableF[0x85 + 1];
 
 };
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "analysis.hpp"
+#include "capture.hpp"
+#include "chip8.hpp"
+#include "movie.hpp"
+#include "profile.hpp"
+#include "savestate.hpp"
+#include "scheduler.hpp"
+#include "trace.hpp"
+
+// number of instructions kept by --trace
+const size_t TRACE_CAPACITY = 1 << 16;
+// emulated instructions per second unless --ips is given
+const unsigned int DEFAULT_IPS = 700;
+// Cxkk seed unless --seed is given; fixed so runs are reproducible
+const uint64_t DEFAULT_SEED = 1;
+
+// Runs a ROM without Platform (no SDL window) as fast as the host allows.
+// Useful for regression ROMs on render-less boxes and for measuring raw interpreter speed.
+
+static void usage(char const* name){
+    std::cerr << "Usage: " << name << " [--cycles N] [--ips N] [--engine table|threaded|jit] [--trace FILE] [--seed N] [--load-state FILE] [--save-state FILE] [--replay FILE [--seek FRAME]] [--profile FILE] [--profile-folded FILE] [--no-idle-skip] [--variant chip8|schip|xochip] [--pretranslate] [--capture FILE [--capture-format raw|ppm|gif]] <ROM>" << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv){
+    // number of instructions to execute before reporting
+    unsigned long long cycles = 10000000ULL;
+    // emulated speed; decides how many instructions run between timer ticks
+    unsigned int ips = DEFAULT_IPS;
+    char const* romName = nullptr;
+    // execution engine used for the run
+    Engine engine = ENGINE_TABLE;
+    // file the instruction trace is written to, if tracing
+    char const* traceName = nullptr;
+    uint64_t seed = DEFAULT_SEED;
+    // state to resume from instead of starting the ROM fresh; the ROM may then be left out
+    char const* loadStateName = nullptr;
+    // file the final state is written to
+    char const* saveStateName = nullptr;
+    // movie to replay instead of running for `cycles`; it brings its own ROM, seed and speed
+    char const* replayName = nullptr;
+    // frame of the movie to start at
+    uint64_t seekFrame = 0;
+    // files the profile report and its folded stacks are written to, if profiling
+    char const* profileName = nullptr;
+    char const* foldedName = nullptr;
+    // run idle loops instruction by instruction, e.g. to time the engines themselves
+    bool idleSkip = true;
+    // instruction set of the ROM; a loaded state or movie brings its own
+    Variant variant = VARIANT_CHIP8;
+    // analyze the program and let the engine translate its blocks before the clock starts
+    bool pretranslate = false;
+    // file the display of every frame that changed it is streamed to, if capturing
+    char const* captureName = nullptr;
+    CaptureFormat captureFormat = CAPTURE_RAW;
+
+    for (int i = 1; i < argc; ++i){
+        if (std::strcmp(argv[i], "--cycles") == 0 && i + 1 < argc){
+            cycles = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--ips") == 0 && i + 1 < argc){
+            ips = std::stoul(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc){
+            if (!Chip8::EngineFromName(argv[++i], engine)){
+                usage(argv[0]);
+            }
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc){
+            traceName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+            seed = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--load-state") == 0 && i + 1 < argc){
+            loadStateName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--save-state") == 0 && i + 1 < argc){
+            saveStateName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc){
+            replayName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--seek") == 0 && i + 1 < argc){
+            seekFrame = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc){
+            profileName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--profile-folded") == 0 && i + 1 < argc){
+            foldedName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--no-idle-skip") == 0){
+            idleSkip = false;
+        }
+        else if (std::strcmp(argv[i], "--variant") == 0 && i + 1 < argc){
+            if (!Chip8::VariantFromName(argv[++i], variant)){
+                usage(argv[0]);
+            }
+        }
+        else if (std::strcmp(argv[i], "--pretranslate") == 0){
+            pretranslate = true;
+        }
+        else if (std::strcmp(argv[i], "--capture") == 0 && i + 1 < argc){
+            captureName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--capture-format") == 0 && i + 1 < argc){
+            if (!Capture::FormatFromName(argv[++i], captureFormat)){
+                usage(argv[0]);
+            }
+        }
+        else if (argv[i][0] == '-'){
+            usage(argv[0]);
+        }
+        else{
+            romName = argv[i];
+        }
+    }
+
+    if ((romName == nullptr && loadStateName == nullptr && replayName == nullptr) || ips < TIMER_HZ){
+        usage(argv[0]);
+    }
+
+    Movie movie;
+    if (replayName != nullptr){
+        if (!movie.Load(replayName) || movie.InstructionsPerSecond() < TIMER_HZ){
+            std::cerr << "Could not load movie " << replayName << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        ips = movie.InstructionsPerSecond();
+    }
+
+    Chip8 chip8(seed);
+    chip8.SetVariant(variant);
+    if (romName != nullptr && !chip8.LoadROM(romName)){
+        std::cerr << "Could not open ROM " << romName << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    if (loadStateName != nullptr){
+        SnapshotFile snapshot;
+        if (!snapshot.Open(loadStateName) || !chip8.LoadState(*snapshot.State(0))){
+            std::cerr << "Could not load state " << loadStateName << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    chip8.SetEngine(engine);
+    chip8.SetIdleSkip(idleSkip);
+
+    Trace* trace = nullptr;
+    if (traceName != nullptr){
+        trace = &chip8.EnableTrace(TRACE_CAPACITY);
+        trace->DumpOnCrash(traceName);
+    }
+
+    Scheduler scheduler(ips);
+    if (replayName != nullptr && !movie.Seek(chip8, scheduler, seekFrame)){
+        std::cerr << "Movie " << replayName << " is empty" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    // after Seek, which may bring the program itself
+    double analysisSeconds = 0;
+    if (pretranslate){
+        auto analysisStart = std::chrono::high_resolution_clock::now();
+        Analysis analysis(chip8);
+        chip8.Pretranslate(analysis);
+        analysisSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - analysisStart).count();
+    }
+
+    // after Seek, so only the frames actually replayed are counted
+    Profile* profile = nullptr;
+    if (profileName != nullptr || foldedName != nullptr){
+        profile = &chip8.EnableProfile();
+    }
+
+    Capture capture;
+    if (captureName != nullptr && !capture.Open(captureName, captureFormat)){
+        std::cerr << "Could not create capture " << captureName << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    // run whole frames so timers tick exactly as they would on screen
+    unsigned long long executed = 0;
+    if (replayName != nullptr){
+        for (uint64_t frame = scheduler.Frames(); frame < movie.Frames(); ++frame){
+            movie.Apply(chip8, frame);
+            executed += scheduler.RunFrame(chip8);
+            capture.Frame(chip8);
+        }
+    }
+    else{
+        while (executed < cycles){
+            executed += scheduler.RunFrame(chip8);
+            capture.Frame(chip8);
+        }
+    }
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+    std::cout << std::dec;
+    std::cout << "engine: " << Chip8::EngineName(engine) << std::endl;
+    std::cout << "variant: " << Chip8::VariantName(chip8.GetVariant()) << std::endl;
+    std::cout << "instructions: " << executed << std::endl;
+    std::cout << "frames: " << scheduler.Frames() << std::endl;
+    std::cout << "emulated seconds: " << (double)scheduler.Frames() / TIMER_HZ << std::endl;
+    std::cout << "seconds: " << seconds << std::endl;
+    std::cout << "instructions/second: " << (seconds > 0 ? executed / seconds : 0) << std::endl;
+    std::cout << "skipped instructions: " << chip8.SkippedInstructions() << std::endl;
+    if (pretranslate){
+        std::cout << "pretranslate seconds: " << analysisSeconds << std::endl;
+    }
+    std::cout << "video hash: " << std::hex << chip8.VideoHash() << std::dec << std::endl;
+
+    if (captureName != nullptr){
+        std::cout << "captured frames: " << capture.Written() << " of " << capture.Frames() << std::endl;
+        if (!capture.Close()){
+            std::cerr << "Could not write capture " << captureName << std::endl;
+        }
+    }
+
+    if (trace != nullptr){
+        trace->Dump(traceName);
+    }
+    if (profileName != nullptr && !profile->Report(profileName)){
+        std::cerr << "Could not write profile " << profileName << std::endl;
+    }
+    if (foldedName != nullptr && !profile->Folded(foldedName)){
+        std::cerr << "Could not write profile " << foldedName << std::endl;
+    }
+    if (saveStateName != nullptr){
+        SnapshotFile snapshot;
+        if (!snapshot.Create(saveStateName, 1, chip8.StateSize())){
+            std::cerr << "Could not save state " << saveStateName << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        chip8.SaveState(*snapshot.State(0));
+    }
+    return 0;
+}
@@ -0,0 +1,481 @@
+#include "jit.hpp"
+#include "analysis.hpp"
+#include <cstring>
+
+#ifdef CHIP8_JIT_X64
+#include <sys/mman.h>
+#endif
+
+// size of the executable buffer; everything is flushed when it fills up
+const size_t JIT_BUFFER_SIZE = 1 << 20;
+// longest block in instructions
+const unsigned int MAX_BLOCK_LENGTH = 64;
+// generous upper bound on the bytes one block can take (Fx65 is the largest at ~370)
+const size_t MAX_BLOCK_BYTES = MAX_BLOCK_LENGTH * 512;
+
+namespace{
+
+// x86 register numbers used in ModRM
+const uint8_t EAX = 0;
+const uint8_t ECX = 1;
+
+// condition codes for setcc / cmovcc
+const uint8_t CC_B = 0x2;
+const uint8_t CC_E = 0x4;
+const uint8_t CC_NE = 0x5;
+const uint8_t CC_A = 0x7;
+
+// opcodes of "op r8, r/m8"
+const uint8_t ALU_OR = 0x0A;
+const uint8_t ALU_AND = 0x22;
+const uint8_t ALU_XOR = 0x32;
+const uint8_t ALU_ADD = 0x02;
+const uint8_t ALU_SUB = 0x2A;
+const uint8_t ALU_CMP = 0x3A;
+
+/*
+ * Writes x86-64 machine code. Every memory operand is relative to rdi, which
+ * holds the Chip8 pointer for the whole block; only rax and rcx are clobbered.
+ */
+class Emitter{
+    public:
+        explicit Emitter(uint8_t* out) : start(out), out(out) {}
+
+        size_t Size() const { return out - start; }
+
+        // mov r8, [rdi + disp]
+        void LoadByte(uint8_t reg, int32_t disp){ Byte(0x8A); Mem(reg, disp); }
+        // mov [rdi + disp], r8
+        void StoreByte(int32_t disp, uint8_t reg){ Byte(0x88); Mem(reg, disp); }
+        // mov byte [rdi + disp], imm8
+        void StoreByteImm(int32_t disp, uint8_t imm){ Byte(0xC6); Mem(0, disp); Byte(imm); }
+        // add byte [rdi + disp], imm8
+        void AddByteImm(int32_t disp, uint8_t imm){ Byte(0x80); Mem(0, disp); Byte(imm); }
+        // cmp byte [rdi + disp], imm8
+        void CmpByteImm(int32_t disp, uint8_t imm){ Byte(0x80); Mem(7, disp); Byte(imm); }
+        // <op> r8, [rdi + disp]
+        void AluByte(uint8_t op, uint8_t reg, int32_t disp){ Byte(op); Mem(reg, disp); }
+        // inc / dec byte [rdi + disp]
+        void IncByte(int32_t disp){ Byte(0xFE); Mem(0, disp); }
+        void DecByte(int32_t disp){ Byte(0xFE); Mem(1, disp); }
+        // movzx r32, byte [rdi + disp]
+        void MovzxByte(uint8_t reg, int32_t disp){ Byte(0x0F); Byte(0xB6); Mem(reg, disp); }
+        // movzx r32, word [rdi + disp]
+        void MovzxWord(uint8_t reg, int32_t disp){ Byte(0x0F); Byte(0xB7); Mem(reg, disp); }
+        // mov word [rdi + disp], imm16
+        void StoreWordImm(int32_t disp, uint16_t imm){ Byte(0x66); Byte(0xC7); Mem(0, disp); Word(imm); }
+        // mov [rdi + disp], r16
+        void StoreWord(int32_t disp, uint8_t reg){ Byte(0x66); Byte(0x89); Mem(reg, disp); }
+        // add [rdi + disp], r16
+        void AddWord(int32_t disp, uint8_t reg){ Byte(0x66); Byte(0x01); Mem(reg, disp); }
+
+        // mov r64, [rdi + disp]
+        void LoadPointer(uint8_t reg, int32_t disp){ Byte(0x48); Byte(0x8B); Mem(reg, disp); }
+        // mov r8, [rcx + rax]
+        void LoadByteRcxIndexed(uint8_t reg){ Byte(0x8A); Byte(0x04 | (reg << 3)); Byte(0x01); }
+        // cmp byte [rdi + rax + disp], imm8
+        void CmpByteIndexedImm(int32_t disp, uint8_t imm){ Byte(0x80); MemIndexed(7, 0, disp); Byte(imm); }
+        // movzx r32, word [rdi + rax * 2 + disp]
+        void MovzxWordIndexed(uint8_t reg, int32_t disp){ Byte(0x0F); Byte(0xB7); MemIndexed(reg, 1, disp); }
+        // mov word [rdi + rax * 2 + disp], imm16
+        void StoreWordIndexedImm(int32_t disp, uint16_t imm){ Byte(0x66); Byte(0xC7); MemIndexed(0, 1, disp); Word(imm); }
+
+        // mov r32, imm32
+        void MovImm(uint8_t reg, uint32_t imm){ Byte(0xB8 + reg); Dword(imm); }
+        // add eax, imm32
+        void AddEaxImm(uint32_t imm){ Byte(0x05); Dword(imm); }
+        // and eax, imm32
+        void AndEaxImm(uint32_t imm){ Byte(0x25); Dword(imm); }
+        // cmp eax, imm32
+        void CmpEaxImm(uint32_t imm){ Byte(0x3D); Dword(imm); }
+        // and dst8, src8
+        void AndByteRegs(uint8_t dst, uint8_t src){ Byte(0x20); Byte(0xC0 | (src << 3) | dst); }
+        // inc eax
+        void IncEax(){ Byte(0xFF); Byte(0xC0); }
+        // and al, imm8
+        void AndAlImm(uint8_t imm){ Byte(0x24); Byte(imm); }
+        // shr al, n
+        void ShrAl(uint8_t n){ Byte(0xC0); Byte(0xE8); Byte(n); }
+        // shl al, 1
+        void ShlAl1(){ Byte(0xD0); Byte(0xE0); }
+        // lea eax, [rax + rax * 4]
+        void TimesFiveEax(){ Byte(0x8D); Byte(0x04); Byte(0x80); }
+        // setcc r8
+        void Setcc(uint8_t cc, uint8_t reg){ Byte(0x0F); Byte(0x90 + cc); Byte(0xC0 | reg); }
+        // cmovcc dst32, src32
+        void Cmov(uint8_t cc, uint8_t dst, uint8_t src){ Byte(0x0F); Byte(0x40 + cc); Byte(0xC0 | (dst << 3) | src); }
+        void Ret(){ Byte(0xC3); }
+
+    private:
+        uint8_t* start;
+        uint8_t* out;
+
+        void Byte(uint8_t value){ *out++ = value; }
+        void Word(uint16_t value){ Byte(value & 0xFFu); Byte(value >> 8u); }
+        void Dword(uint32_t value){ Word(value & 0xFFFFu); Word(value >> 16u); }
+
+        // ModRM for [rdi + disp32]
+        void Mem(uint8_t reg, int32_t disp){ Byte(0x87 | (reg << 3)); Dword(disp); }
+        // ModRM + SIB for [rdi + rax * (1 << scale) + disp32]
+        void MemIndexed(uint8_t reg, uint8_t scale, int32_t disp){ Byte(0x84 | (reg << 3)); Byte((scale << 6) | 0x07); Dword(disp); }
+};
+
+}
+
+// byte offset of a member of chip8 from the start of the object
+static int32_t OffsetOf(Chip8 const& chip8, void const* member){
+    return static_cast<int32_t>(static_cast<uint8_t const*>(member) - reinterpret_cast<uint8_t const*>(&chip8));
+}
+
+Jit::Jit(Chip8& chip8)
+    : chip8(chip8)
+    {
+    registersOffset = OffsetOf(chip8, chip8.registers);
+    indexOffset = OffsetOf(chip8, &chip8.index);
+    pcOffset = OffsetOf(chip8, &chip8.pc);
+    stackOffset = OffsetOf(chip8, chip8.stack);
+    spOffset = OffsetOf(chip8, &chip8.sp);
+    delayTimerOffset = OffsetOf(chip8, &chip8.delayTimer);
+    soundTimerOffset = OffsetOf(chip8, &chip8.soundTimer);
+    keypadOffset = OffsetOf(chip8, chip8.keypad);
+    memoryPointerOffset = OffsetOf(chip8, &chip8.memory);
+
+#ifdef CHIP8_JIT_X64
+    void* mapped = mmap(nullptr, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped != MAP_FAILED){
+        buffer = static_cast<uint8_t*>(mapped);
+    }
+#endif
+
+    Flush();
+}
+
+Jit::~Jit(){
+#ifdef CHIP8_JIT_X64
+    if (buffer != nullptr){
+        munmap(buffer, JIT_BUFFER_SIZE);
+    }
+#endif
+}
+
+void Jit::Flush(){
+    memset(blocks, 0, sizeof(blocks));
+    memset(covered, 0, sizeof(covered));
+    used = 0;
+}
+
+void Jit::Invalidate(unsigned int address, unsigned int length){
+    unsigned int first = address > 0 ? address - 1 : 0;
+    unsigned int last = address + length < MEMORY_SIZE ? address + length : MEMORY_SIZE;
+
+    for (unsigned int addr = first; addr < last; ++addr){
+        // code was overwritten; translated blocks may be anywhere before it, so start over
+        if (covered[addr]){
+            Flush();
+            return;
+        }
+        // an instruction that could not be translated may be translatable now
+        if (blocks[addr].state == BLOCK_INTERPRET){
+            blocks[addr].state = BLOCK_EMPTY;
+        }
+    }
+}
+
+void Jit::Prepare(Analysis const& analysis){
+    for (BasicBlock const& block : analysis.Blocks()){
+        // a store overwrites it, so the translation would soon be flushed again
+        if (block.written){
+            continue;
+        }
+
+        // a translation stops early at anything it cannot translate; go on after it
+        unsigned int addr = block.start;
+        while (addr < block.end && addr < MEMORY_SIZE){
+            if (blocks[addr].state == BLOCK_EMPTY){
+                Translate(addr);
+            }
+            if (blocks[addr].state == BLOCK_NATIVE){
+                addr += 2 * blocks[addr].length;
+            }
+            else{
+                addr += chip8.decoded[addr].id == OPID_F000 ? 4 : 2;
+            }
+        }
+    }
+}
+
+unsigned int Jit::Run(unsigned int count){
+    unsigned int executed = 0;
+
+    while (executed < count){
+        // blocks are keyed by the first 4 KB only; XO-CHIP code above it and a runaway PC go to the interpreter
+        if (chip8.pc < MEMORY_SIZE){
+            Block& block = blocks[chip8.pc];
+
+            if (block.state == BLOCK_EMPTY){
+                Translate(chip8.pc);
+            }
+            // never run past the budget, so frames line up with the other engines
+            if (block.state == BLOCK_NATIVE && block.length <= count - executed){
+                block.code(&chip8);
+                executed += block.length;
+                continue;
+            }
+        }
+
+        chip8.Cycle();
+        ++executed;
+        // Fx0A is never translated; once it blocks, the rest of the budget is spent waiting
+        if (chip8.keyWait){
+            executed = count;
+        }
+    }
+
+    return executed;
+}
+
+void Jit::Translate(unsigned int address){
+#ifdef CHIP8_JIT_X64
+    if (buffer == nullptr){
+        blocks[address].state = BLOCK_INTERPRET;
+        return;
+    }
+    if (JIT_BUFFER_SIZE - used < MAX_BLOCK_BYTES){
+        Flush();
+    }
+
+    Emitter emit(buffer + used);
+    unsigned int addr = address;
+    unsigned int length = 0;
+    // true once a control-flow opcode has set PC itself
+    bool ended = false;
+    // end of the bytes the block depends on; past addr when a skip looked at the next instruction
+    unsigned int coveredEnd = address;
+
+    // register Vn
+    #define V(n) (registersOffset + (n))
+
+    // XO-CHIP blocks stop an instruction early, so the opcode after a skip is always in range
+    unsigned int limit = chip8.variant == VARIANT_XOCHIP ? MEMORY_SIZE - 2 : MEMORY_SIZE;
+
+    while (!ended && length < MAX_BLOCK_LENGTH && addr + 1 < limit){
+        Instruction const& instruction = chip8.decoded[addr];
+        uint8_t x = instruction.x;
+        uint8_t y = instruction.y;
+        // PC after this instruction, and after this instruction plus a skip
+        uint16_t next = addr + 2;
+        uint16_t skip = addr + 4;
+        // an XO-CHIP skip steps over both halves of F000 nnnn, so it depends on the next opcode too
+        if (chip8.variant == VARIANT_XOCHIP && chip8.decoded[next].id == OPID_F000){
+            skip = addr + 6;
+        }
+
+        switch (instruction.id){
+            case OPID_NULL:
+                break;
+            case OPID_6xkk:
+                emit.StoreByteImm(V(x), instruction.kk);
+                break;
+            case OPID_7xkk:
+                emit.AddByteImm(V(x), instruction.kk);
+                break;
+            case OPID_8xy0:
+                emit.LoadByte(EAX, V(y));
+                emit.StoreByte(V(x), EAX);
+                break;
+            case OPID_8xy1:
+            case OPID_8xy2:
+            case OPID_8xy3:
+                emit.LoadByte(EAX, V(x));
+                emit.AluByte(instruction.id == OPID_8xy1 ? ALU_OR : instruction.id == OPID_8xy2 ? ALU_AND : ALU_XOR, EAX, V(y));
+                emit.StoreByte(V(x), EAX);
+                break;
+            case OPID_8xy4:
+                emit.LoadByte(EAX, V(x));
+                emit.AluByte(ALU_ADD, EAX, V(y));
+                emit.Setcc(CC_B, ECX);
+                emit.StoreByte(V(0xF), ECX);
+                emit.StoreByte(V(x), EAX);
+                break;
+            case OPID_8xy5:
+                // VF is written before Vx is recomputed, as in OP_8xy5
+                emit.LoadByte(EAX, V(x));
+                emit.AluByte(ALU_CMP, EAX, V(y));
+                emit.Setcc(CC_A, ECX);
+                emit.StoreByte(V(0xF), ECX);
+                emit.LoadByte(EAX, V(x));
+                emit.AluByte(ALU_SUB, EAX, V(y));
+                emit.StoreByte(V(x), EAX);
+                break;
+            case OPID_8xy6:
+                emit.LoadByte(EAX, V(x));
+                emit.AndAlImm(0x1);
+                emit.StoreByte(V(0xF), EAX);
+                emit.LoadByte(EAX, V(x));
+                emit.ShrAl(1);
+                emit.StoreByte(V(x), EAX);
+                break;
+            case OPID_8xy7:
+                emit.LoadByte(EAX, V(x));
+                emit.AluByte(ALU_CMP, EAX, V(y));
+                emit.Setcc(CC_B, ECX);
+                emit.StoreByte(V(0xF), ECX);
+                emit.LoadByte(EAX, V(y));
+                emit.AluByte(ALU_SUB, EAX, V(x));
+                emit.StoreByte(V(x), EAX);
+                break;
+            case OPID_8xyE:
+                emit.LoadByte(EAX, V(x));
+                emit.ShrAl(7);
+                emit.StoreByte(V(0xF), EAX);
+                emit.LoadByte(EAX, V(x));
+                emit.ShlAl1();
+                emit.StoreByte(V(x), EAX);
+                break;
+            case OPID_Annn:
+                emit.StoreWordImm(indexOffset, instruction.nnn);
+                break;
+            case OPID_Fx07:
+                emit.LoadByte(EAX, delayTimerOffset);
+                emit.StoreByte(V(x), EAX);
+                break;
+            case OPID_Fx15:
+                emit.LoadByte(EAX, V(x));
+                emit.StoreByte(delayTimerOffset, EAX);
+                break;
+            case OPID_Fx18:
+                emit.LoadByte(EAX, V(x));
+                emit.StoreByte(soundTimerOffset, EAX);
+                break;
+            case OPID_Fx1E:
+                emit.MovzxByte(EAX, V(x));
+                emit.AddWord(indexOffset, EAX);
+                break;
+            case OPID_Fx29:
+                emit.MovzxByte(EAX, V(x));
+                emit.TimesFiveEax();
+                emit.AddEaxImm(FONTSET_START_ADDRESS);
+                emit.StoreWord(indexOffset, EAX);
+                break;
+            case OPID_Fx65:
+                // I + i wraps around the end of memory
+                emit.MovzxWord(EAX, indexOffset);
+                for (unsigned int i = 0; i <= x; ++i){
+                    if (i > 0){
+                        emit.IncEax();
+                    }
+                    emit.AndEaxImm(chip8.memoryMask);
+                    emit.LoadPointer(ECX, memoryPointerOffset);
+                    emit.LoadByteRcxIndexed(ECX);
+                    emit.StoreByte(V(i), ECX);
+                }
+                break;
+
+            // control flow: store the new PC and end the block
+            case OPID_1nnn:
+                emit.StoreWordImm(pcOffset, instruction.nnn);
+                ended = true;
+                break;
+            case OPID_2nnn:
+                emit.MovzxByte(EAX, spOffset);
+                emit.AndEaxImm(STACK_LEVEL - 1);
+                emit.StoreWordIndexedImm(stackOffset, next);
+                emit.IncByte(spOffset);
+                emit.StoreWordImm(pcOffset, instruction.nnn);
+                ended = true;
+                break;
+            case OPID_00EE:
+                emit.DecByte(spOffset);
+                emit.MovzxByte(EAX, spOffset);
+                emit.AndEaxImm(STACK_LEVEL - 1);
+                emit.MovzxWordIndexed(ECX, stackOffset);
+                emit.StoreWord(pcOffset, ECX);
+                ended = true;
+                break;
+            case OPID_Bnnn:
+                emit.MovzxByte(EAX, V(0));
+                emit.AddEaxImm(instruction.nnn);
+                emit.StoreWord(pcOffset, EAX);
+                ended = true;
+                break;
+            case OPID_3xkk:
+            case OPID_4xkk:
+            case OPID_5xy0:
+            case OPID_9xy0:
+            case OPID_Ex9E:
+            case OPID_ExA1:
+            {
+                // set flags, then pick next or skip with a cmov
+                uint8_t cc;
+                if (instruction.id == OPID_3xkk || instruction.id == OPID_4xkk){
+                    emit.CmpByteImm(V(x), instruction.kk);
+                    cc = instruction.id == OPID_3xkk ? CC_E : CC_NE;
+                }
+                else if (instruction.id == OPID_5xy0 || instruction.id == OPID_9xy0){
+                    emit.LoadByte(EAX, V(x));
+                    emit.AluByte(ALU_CMP, EAX, V(y));
+                    cc = instruction.id == OPID_5xy0 ? CC_E : CC_NE;
+                }
+                else{
+                    // pressed = Vx < KEY_COUNT && keypad[Vx], with the index masked so it
+                    // stays inside keypad; leaves ZF clear only for a pressed key
+                    emit.MovzxByte(EAX, V(x));
+                    emit.CmpEaxImm(KEY_COUNT);
+                    emit.Setcc(CC_B, ECX);
+                    emit.AndEaxImm(KEY_COUNT - 1);
+                    emit.CmpByteIndexedImm(keypadOffset, 0);
+                    emit.Setcc(CC_NE, EAX);
+                    emit.AndByteRegs(EAX, ECX);
+                    // Ex9E skips if the key is down (nonzero)
+                    cc = instruction.id == OPID_Ex9E ? CC_NE : CC_E;
+                }
+                emit.MovImm(EAX, next);
+                emit.MovImm(ECX, skip);
+                emit.Cmov(cc, EAX, ECX);
+                emit.StoreWord(pcOffset, EAX);
+                ended = true;
+                if (chip8.variant == VARIANT_XOCHIP){
+                    coveredEnd = next + 2;
+                }
+                break;
+            }
+
+            default:
+                // not translatable; the block ends before it and the interpreter takes over
+                if (length == 0){
+                    blocks[address].state = BLOCK_INTERPRET;
+                    return;
+                }
+                emit.StoreWordImm(pcOffset, addr);
+                ended = true;
+                continue;
+        }
+
+        ++length;
+        addr += 2;
+    }
+
+    #undef V
+
+    if (length == 0){
+        blocks[address].state = BLOCK_INTERPRET;
+        return;
+    }
+    if (!ended){
+        // ran into the length limit or the end of memory
+        emit.StoreWordImm(pcOffset, addr);
+    }
+    emit.Ret();
+
+    // the block read memory[address, addr), and maybe the instruction after its last skip
+    memset(covered + address, 1, (coveredEnd > addr ? coveredEnd : addr) - address);
+
+    Block& block = blocks[address];
+    block.code = reinterpret_cast<BlockFunc>(buffer + used);
+    block.length = length;
+    block.state = BLOCK_NATIVE;
+    used += emit.Size();
+#else
+    blocks[address].state = BLOCK_INTERPRET;
+#endif
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "chip8.hpp"
+
+class Analysis;
+
+// The recompiler emits x86-64 System V code. Everywhere else Jit::Run just interprets.
+#if defined(__x86_64__) && !defined(_WIN32)
+#define CHIP8_JIT_X64 1
+#endif
+
+/*
+ * Dynamic recompiler for CHIP-8 basic blocks.
+ *
+ * A block is a straight-line run of register/timer/index opcodes starting at some
+ * address, optionally ended by a control-flow opcode it can also translate (1nnn,
+ * 2nnn, 00EE, Bnnn, skips). Blocks are translated to native code on first use
+ * and looked up by PC afterwards. Anything else (Dxyn, Cxkk, Fx0A, Fx33, Fx55,
+ * 00E0, ...) is executed by Chip8::Cycle(), so the JIT never has to be complete.
+ *
+ * Generated code works directly on the Chip8 object passed in rdi and mirrors the
+ * OP_* handlers exactly, including the order VF and Vx are written in.
+ */
+class Jit{
+    public:
+        explicit Jit(Chip8& chip8);
+        ~Jit();
+
+        // execute `count` instructions; returns number executed
+        unsigned int Run(unsigned int count);
+
+        // memory[address, address + length) was written; drop translations that read it
+        void Invalidate(unsigned int address, unsigned int length);
+
+        // translate every block of the analysis up front, except those it saw being written to
+        void Prepare(Analysis const& analysis);
+
+        // false if executable memory could not be mapped (or not x86-64); Run still works
+        bool Available() const { return buffer != nullptr; }
+
+    private:
+        // native code for one block; takes the Chip8 the block runs on
+        typedef void (*BlockFunc)(Chip8* chip8);
+
+        enum BlockState : uint8_t{
+            // not looked at yet
+            BLOCK_EMPTY,
+            // translated; code is valid
+            BLOCK_NATIVE,
+            // first instruction cannot be translated; always use the interpreter
+            BLOCK_INTERPRET
+        };
+
+        struct Block{
+            BlockFunc code;
+            // instructions executed by one call of code
+            uint16_t length;
+            uint8_t state;
+        };
+
+        Chip8& chip8;
+
+        // executable buffer that all blocks are emitted into
+        uint8_t* buffer{};
+        // first unused byte of buffer
+        size_t used{};
+
+        // blocks[addr] is the block starting at addr
+        Block blocks[MEMORY_SIZE];
+        // covered[addr] is nonzero if a translated block read memory[addr]
+        uint8_t covered[MEMORY_SIZE];
+
+        // byte offsets of machine state inside Chip8, used as displacements from rdi
+        int32_t registersOffset;
+        int32_t indexOffset;
+        int32_t pcOffset;
+        int32_t stackOffset;
+        int32_t spOffset;
+        int32_t delayTimerOffset;
+        int32_t soundTimerOffset;
+        int32_t keypadOffset;
+        // memory is reached through Chip8::memory, since it moves when the variant changes
+        int32_t memoryPointerOffset;
+
+        // translate the block at address; leaves it BLOCK_NATIVE or BLOCK_INTERPRET
+        void Translate(unsigned int address);
+        // drop every translation and reuse the whole buffer
+        void Flush();
+
+        Jit(Jit const&);
+        Jit& operator=(Jit const&);
+};
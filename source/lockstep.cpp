@@ -0,0 +1,579 @@
+#include "lockstep.hpp"
+#include <algorithm>
+#include <cstring>
+
+#ifdef CHIP8_LOCKSTEP_AVX2
+#include <immintrin.h>
+#endif
+
+// lanes per AVX2 register of bytes; every per-lane array is padded to a multiple of this
+const unsigned int LANE_BLOCK = 32;
+// a PC shared by fewer lanes than this is not worth a pass over all lanes
+const unsigned int VECTOR_MIN_LANES = 8;
+
+Lockstep::Lockstep(unsigned int lanes, uint64_t seed)
+    : lanes(lanes),
+      stride((lanes + LANE_BLOCK - 1) / LANE_BLOCK * LANE_BLOCK),
+      vectorized(false),
+      seed(seed)
+    {
+#ifdef CHIP8_LOCKSTEP_AVX2
+    vectorized = __builtin_cpu_supports("avx2");
+#endif
+
+    registers.resize(REGISTER_COUNT * stride);
+    pc.resize(stride);
+    index.resize(stride);
+    stack.resize(STACK_LEVEL * stride);
+    sp.resize(stride);
+    delayTimer.resize(stride);
+    soundTimer.resize(stride);
+    keys.resize(stride);
+    random.resize(stride);
+    memory.resize((size_t)stride * MEMORY_SIZE);
+    video.resize((size_t)stride * VIDEO_HEIGHT);
+    codeWritten.resize(MEMORY_SIZE);
+    pending.resize(stride);
+    group.resize(stride);
+
+    LoadROM(nullptr, 0);
+}
+
+Lockstep::~Lockstep(){
+}
+
+bool Lockstep::LoadROM(uint8_t const* data, size_t size){
+    // a fresh Chip8 already has the font, the ROM and the decoded instructions laid out
+    std::unique_ptr<Chip8> fresh(new Chip8(seed));
+    if (size > 0 && !fresh->LoadROM(data, size)){
+        return false;
+    }
+    decoder = std::move(fresh);
+    image.assign(decoder->memory, decoder->memory + MEMORY_SIZE);
+    decoded.assign(decoder->decoded, decoder->decoded + MEMORY_SIZE);
+    std::fill(codeWritten.begin(), codeWritten.end(), 0);
+
+    std::fill(registers.begin(), registers.end(), 0);
+    std::fill(pc.begin(), pc.end(), START_ADDRESS);
+    std::fill(index.begin(), index.end(), 0);
+    std::fill(stack.begin(), stack.end(), 0);
+    std::fill(sp.begin(), sp.end(), 0);
+    std::fill(delayTimer.begin(), delayTimer.end(), 0);
+    std::fill(soundTimer.begin(), soundTimer.end(), 0);
+    std::fill(keys.begin(), keys.end(), 0);
+    std::fill(video.begin(), video.end(), 0);
+
+    for (unsigned int lane = 0; lane < stride; ++lane){
+        memcpy(&memory[(size_t)lane * MEMORY_SIZE], image.data(), MEMORY_SIZE);
+        random[lane].Seed(seed + lane);
+    }
+    return true;
+}
+
+void Lockstep::Run(unsigned int count){
+    for (unsigned int i = 0; i < count; ++i){
+        Step();
+    }
+}
+
+void Lockstep::TickTimers(){
+    // simple enough for the compiler to vectorize on its own
+    for (unsigned int lane = 0; lane < stride; ++lane){
+        delayTimer[lane] -= delayTimer[lane] > 0;
+        soundTimer[lane] -= soundTimer[lane] > 0;
+    }
+}
+
+uint64_t Lockstep::VideoHash(unsigned int lane) const{
+    // must match Chip8::VideoHash
+    uint64_t const* rows = Video(lane);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned int y = 0; y < VIDEO_HEIGHT; ++y){
+        for (int shift = 56; shift >= 0; shift -= 8){
+            hash ^= (rows[y] >> shift) & 0xFFu;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+bool Lockstep::Halted(unsigned int lane) const{
+    Instruction instruction = LaneInstruction(lane);
+    return instruction.id == OPID_1nnn && instruction.nnn == pc[lane];
+}
+
+void Lockstep::Step(){
+    if (lanes == 0){
+        return;
+    }
+
+    // usual case: every lane is at the same instruction and nobody wrote over it
+    uint16_t first = pc[0];
+    unsigned int together = 1;
+    while (together < lanes && pc[together] == first){
+        ++together;
+    }
+    unsigned int address = first & (MEMORY_SIZE - 1);
+    bool written = codeWritten[address] || codeWritten[(address + 1) & (MEMORY_SIZE - 1)];
+
+    if (together == lanes && !written){
+        memset(group.data(), 0xFF, lanes);
+#ifdef CHIP8_LOCKSTEP_AVX2
+        if (vectorized){
+            StepGroupAVX2(decoded[address]);
+            return;
+        }
+#endif
+        StepGroupScalar(decoded[address]);
+        return;
+    }
+
+    // lanes have drifted apart: peel off groups sharing a PC while they are big enough
+    memset(pending.data(), 0xFF, lanes);
+    for (unsigned int leader = 0; leader < lanes; ++leader){
+        if (!pending[leader]){
+            continue;
+        }
+
+        uint16_t leaderPC = pc[leader];
+        address = leaderPC & (MEMORY_SIZE - 1);
+        written = codeWritten[address] || codeWritten[(address + 1) & (MEMORY_SIZE - 1)];
+
+        unsigned int size = 0;
+        if (!written){
+            for (unsigned int lane = leader; lane < lanes; ++lane){
+                size += pending[lane] && pc[lane] == leaderPC;
+            }
+        }
+
+        if (size < VECTOR_MIN_LANES){
+            // the rest is too scattered (or has its own code); step it one lane at a time
+            for (unsigned int lane = leader; lane < lanes; ++lane){
+                if (pending[lane]){
+                    StepLane(lane, LaneInstruction(lane));
+                }
+            }
+            return;
+        }
+
+        memset(group.data(), 0, leader);
+        for (unsigned int lane = leader; lane < lanes; ++lane){
+            group[lane] = (pending[lane] && pc[lane] == leaderPC) ? 0xFF : 0;
+            pending[lane] &= ~group[lane];
+        }
+#ifdef CHIP8_LOCKSTEP_AVX2
+        if (vectorized){
+            StepGroupAVX2(decoded[address]);
+            continue;
+        }
+#endif
+        StepGroupScalar(decoded[address]);
+    }
+}
+
+Instruction Lockstep::LaneInstruction(unsigned int lane) const{
+    unsigned int address = pc[lane] & (MEMORY_SIZE - 1);
+    unsigned int next = (address + 1) & (MEMORY_SIZE - 1);
+    if (!codeWritten[address] && !codeWritten[next]){
+        return decoded[address];
+    }
+    uint8_t const* laneMemory = &memory[(size_t)lane * MEMORY_SIZE];
+    return decoder->Decode((laneMemory[address] << 8u) | laneMemory[next]);
+}
+
+void Lockstep::StepLane(unsigned int lane, Instruction const& instruction){
+    pc[lane] += 2;
+    Execute(lane, instruction);
+}
+
+void Lockstep::StepGroupScalar(Instruction const& instruction){
+    for (unsigned int lane = 0; lane < lanes; ++lane){
+        if (group[lane]){
+            StepLane(lane, instruction);
+        }
+    }
+}
+
+void Lockstep::WriteMemory(unsigned int lane, unsigned int address, uint8_t value){
+    address &= MEMORY_SIZE - 1;
+    memory[(size_t)lane * MEMORY_SIZE + address] = value;
+    if (value != image[address]){
+        codeWritten[address] = 1;
+    }
+}
+
+void Lockstep::Execute(unsigned int lane, Instruction const& instruction){
+// register r of this lane
+#define V(r) registers[(r) * stride + lane]
+
+    uint8_t x = instruction.x;
+    uint8_t y = instruction.y;
+    uint8_t kk = instruction.kk;
+    uint16_t nnn = instruction.nnn;
+    uint8_t* laneMemory = &memory[(size_t)lane * MEMORY_SIZE];
+
+    switch (instruction.id){
+        case OPID_00E0:
+            memset(&video[lane * VIDEO_HEIGHT], 0, VIDEO_HEIGHT * sizeof(uint64_t));
+            break;
+        case OPID_00EE:
+            --sp[lane];
+            pc[lane] = stack[(sp[lane] & (STACK_LEVEL - 1)) * stride + lane];
+            break;
+        case OPID_1nnn:
+            pc[lane] = nnn;
+            break;
+        case OPID_2nnn:
+            stack[(sp[lane] & (STACK_LEVEL - 1)) * stride + lane] = pc[lane];
+            ++sp[lane];
+            pc[lane] = nnn;
+            break;
+        case OPID_3xkk:
+            if (V(x) == kk){
+                pc[lane] += 2;
+            }
+            break;
+        case OPID_4xkk:
+            if (V(x) != kk){
+                pc[lane] += 2;
+            }
+            break;
+        case OPID_5xy0:
+            if (V(x) == V(y)){
+                pc[lane] += 2;
+            }
+            break;
+        case OPID_6xkk:
+            V(x) = kk;
+            break;
+        case OPID_7xkk:
+            V(x) += kk;
+            break;
+        case OPID_8xy0:
+            V(x) = V(y);
+            break;
+        case OPID_8xy1:
+            V(x) = V(x) | V(y);
+            break;
+        case OPID_8xy2:
+            V(x) = V(x) & V(y);
+            break;
+        case OPID_8xy3:
+            V(x) = V(x) ^ V(y);
+            break;
+        case OPID_8xy4:
+        {
+            uint32_t total = V(x) + V(y);
+            V(0xF) = total > 255u ? 1u : 0u;
+            V(x) = total & 0xFFu;
+        } break;
+        case OPID_8xy5:
+            V(0xF) = V(x) > V(y) ? 1u : 0u;
+            V(x) = V(x) - V(y);
+            break;
+        case OPID_8xy6:
+            V(0xF) = V(x) & 0x1u;
+            V(x) = V(x) >> 1u;
+            break;
+        case OPID_8xy7:
+            V(0xF) = V(x) < V(y) ? 1u : 0u;
+            V(x) = V(y) - V(x);
+            break;
+        case OPID_8xyE:
+            V(0xF) = (V(x) & 0x80u) >> 7u;
+            V(x) = V(x) << 1u;
+            break;
+        case OPID_9xy0:
+            if (V(x) != V(y)){
+                pc[lane] += 2;
+            }
+            break;
+        case OPID_Annn:
+            index[lane] = nnn;
+            break;
+        case OPID_Bnnn:
+            pc[lane] = nnn + V(0);
+            break;
+        case OPID_Cxkk:
+            V(x) = random[lane].Byte() & kk;
+            break;
+        case OPID_Dxyn:
+        {
+            // same drawing as Chip8::DrawSprite on this lane's memory and display
+            uint64_t* rows = &video[lane * VIDEO_HEIGHT];
+            uint8_t xCoord = V(x) % VIDEO_WIDTH;
+            uint8_t yCoord = V(y) % VIDEO_HEIGHT;
+            unsigned int height = instruction.n;
+            unsigned int count = yCoord + height <= VIDEO_HEIGHT ? height : VIDEO_HEIGHT - yCoord;
+            uint64_t collision = 0;
+            for (unsigned int row = 0; row < count; ++row){
+                uint64_t spriteRow = (uint64_t)laneMemory[(index[lane] + row) & (MEMORY_SIZE - 1)] << 56u >> xCoord;
+                collision |= rows[yCoord + row] & spriteRow;
+                rows[yCoord + row] ^= spriteRow;
+            }
+            V(0xF) = collision != 0;
+        } break;
+        case OPID_Ex9E:
+            if (V(x) < KEY_COUNT && (keys[lane] >> V(x)) & 1u){
+                pc[lane] += 2;
+            }
+            break;
+        case OPID_ExA1:
+            if (!(V(x) < KEY_COUNT && (keys[lane] >> V(x)) & 1u)){
+                pc[lane] += 2;
+            }
+            break;
+        case OPID_Fx07:
+            V(x) = delayTimer[lane];
+            break;
+        case OPID_Fx0A:
+        {
+            // lowest pressed key wins, like the keypad[0]..keypad[15] chain in OP_Fx0A
+            uint16_t pressed = keys[lane];
+            if (pressed){
+                uint8_t key = 0;
+                while (!((pressed >> key) & 1u)){
+                    ++key;
+                }
+                V(x) = key;
+            }
+            else{
+                pc[lane] -= 2;
+            }
+        } break;
+        case OPID_Fx15:
+            delayTimer[lane] = V(x);
+            break;
+        case OPID_Fx18:
+            soundTimer[lane] = V(x);
+            break;
+        case OPID_Fx1E:
+            index[lane] += V(x);
+            break;
+        case OPID_Fx29:
+            index[lane] = FONTSET_START_ADDRESS + (5 * V(x));
+            break;
+        case OPID_Fx33:
+        {
+            uint8_t num = V(x);
+            WriteMemory(lane, index[lane] + 2, num % 10);
+            num /= 10;
+            WriteMemory(lane, index[lane] + 1, num % 10);
+            num /= 10;
+            WriteMemory(lane, index[lane], num % 10);
+        } break;
+        case OPID_Fx55:
+            for (uint8_t i = 0; i <= x; ++i){
+                WriteMemory(lane, index[lane] + i, V(i));
+            }
+            break;
+        case OPID_Fx65:
+            for (uint8_t i = 0; i <= x; ++i){
+                V(i) = laneMemory[(index[lane] + i) & (MEMORY_SIZE - 1)];
+            }
+            break;
+        case OPID_NULL:
+        default:
+            break;
+    }
+
+#undef V
+}
+
+#ifdef CHIP8_LOCKSTEP_AVX2
+
+// byte-lane helpers; group[] holds 0xFF for lanes taking part in the step
+#define LOAD(p) _mm256_loadu_si256((__m256i const*)(p))
+#define STORE(p, value) _mm256_storeu_si256((__m256i*)(p), (value))
+// write value only into the lanes of the group; b is the first lane of the block
+#define STORE_GROUP(p, value) STORE(p, _mm256_blendv_epi8(LOAD(p), (value), LOAD(&group[b])))
+// 16 lanes of group[] widened to 0xFFFF / 0 words
+#define GROUP16(b) _mm256_cvtepi8_epi16(_mm_loadu_si128((__m128i const*)&group[b]))
+// 16 register bytes widened to words
+#define WIDEN(p) _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const*)(p)))
+
+__attribute__((target("avx2")))
+void Lockstep::StepGroupAVX2(Instruction const& instruction){
+    uint8_t* vx = &registers[instruction.x * stride];
+    uint8_t* vy = &registers[instruction.y * stride];
+    uint8_t* vf = &registers[0xF * stride];
+    uint8_t* v0 = &registers[0];
+    uint16_t* pcs = pc.data();
+    uint16_t* indexes = index.data();
+
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const one = _mm256_set1_epi8(1);
+    __m256i const two16 = _mm256_set1_epi16(2);
+
+    // Instruction Cycle: Increment PC, for the whole group
+    for (unsigned int b = 0; b < stride; b += 16){
+        __m256i next = _mm256_add_epi16(LOAD(&pcs[b]), _mm256_and_si256(GROUP16(b), two16));
+        STORE(&pcs[b], next);
+    }
+
+    switch (instruction.id){
+        case OPID_NULL:
+            break;
+        case OPID_1nnn:
+        {
+            __m256i target = _mm256_set1_epi16(instruction.nnn);
+            for (unsigned int b = 0; b < stride; b += 16){
+                STORE(&pcs[b], _mm256_blendv_epi8(LOAD(&pcs[b]), target, GROUP16(b)));
+            }
+        } break;
+        case OPID_3xkk:
+        case OPID_4xkk:
+        case OPID_5xy0:
+        case OPID_9xy0:
+        {
+            // compare 16 lanes of bytes, widen the result and add 2 to the pcs that skip
+            __m128i kk = _mm_set1_epi8(instruction.kk);
+            for (unsigned int b = 0; b < stride; b += 16){
+                __m128i a = _mm_loadu_si128((__m128i const*)&vx[b]);
+                __m128i c = (instruction.id == OPID_3xkk || instruction.id == OPID_4xkk) ? kk : _mm_loadu_si128((__m128i const*)&vy[b]);
+                __m128i equal = _mm_cmpeq_epi8(a, c);
+                __m128i skip = (instruction.id == OPID_3xkk || instruction.id == OPID_5xy0) ? equal : _mm_xor_si128(equal, _mm_set1_epi8(-1));
+                skip = _mm_and_si128(skip, _mm_loadu_si128((__m128i const*)&group[b]));
+                __m256i step = _mm256_and_si256(_mm256_cvtepi8_epi16(skip), two16);
+                STORE(&pcs[b], _mm256_add_epi16(LOAD(&pcs[b]), step));
+            }
+        } break;
+        case OPID_6xkk:
+        {
+            __m256i kk = _mm256_set1_epi8(instruction.kk);
+            for (unsigned int b = 0; b < stride; b += 32){
+                STORE_GROUP(&vx[b], kk);
+            }
+        } break;
+        case OPID_7xkk:
+        {
+            __m256i kk = _mm256_set1_epi8(instruction.kk);
+            for (unsigned int b = 0; b < stride; b += 32){
+                STORE_GROUP(&vx[b], _mm256_add_epi8(LOAD(&vx[b]), kk));
+            }
+        } break;
+        case OPID_8xy0:
+            for (unsigned int b = 0; b < stride; b += 32){
+                STORE_GROUP(&vx[b], LOAD(&vy[b]));
+            }
+            break;
+        case OPID_8xy1:
+            for (unsigned int b = 0; b < stride; b += 32){
+                STORE_GROUP(&vx[b], _mm256_or_si256(LOAD(&vx[b]), LOAD(&vy[b])));
+            }
+            break;
+        case OPID_8xy2:
+            for (unsigned int b = 0; b < stride; b += 32){
+                STORE_GROUP(&vx[b], _mm256_and_si256(LOAD(&vx[b]), LOAD(&vy[b])));
+            }
+            break;
+        case OPID_8xy3:
+            for (unsigned int b = 0; b < stride; b += 32){
+                STORE_GROUP(&vx[b], _mm256_xor_si256(LOAD(&vx[b]), LOAD(&vy[b])));
+            }
+            break;
+        // The flag opcodes write VF first and then reload Vx and Vy, so x or y being F
+        // gives the same result as the scalar handlers.
+        case OPID_8xy4:
+            for (unsigned int b = 0; b < stride; b += 32){
+                __m256i a = LOAD(&vx[b]);
+                __m256i c = LOAD(&vy[b]);
+                __m256i sum = _mm256_add_epi8(a, c);
+                // carried if the saturating sum differs from the wrapping one
+                __m256i carry = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_adds_epu8(a, c), sum), one);
+                STORE_GROUP(&vf[b], carry);
+                STORE_GROUP(&vx[b], sum);
+            }
+            break;
+        case OPID_8xy5:
+            for (unsigned int b = 0; b < stride; b += 32){
+                // Vx > Vy exactly when the saturating Vx - Vy is not 0
+                __m256i greater = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(LOAD(&vx[b]), LOAD(&vy[b])), zero), one);
+                STORE_GROUP(&vf[b], greater);
+                STORE_GROUP(&vx[b], _mm256_sub_epi8(LOAD(&vx[b]), LOAD(&vy[b])));
+            }
+            break;
+        case OPID_8xy6:
+            for (unsigned int b = 0; b < stride; b += 32){
+                STORE_GROUP(&vf[b], _mm256_and_si256(LOAD(&vx[b]), one));
+                // no byte shift in AVX2; shift words and drop the bit that came from the neighbour
+                STORE_GROUP(&vx[b], _mm256_and_si256(_mm256_srli_epi16(LOAD(&vx[b]), 1), _mm256_set1_epi8(0x7F)));
+            }
+            break;
+        case OPID_8xy7:
+            for (unsigned int b = 0; b < stride; b += 32){
+                __m256i less = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(LOAD(&vy[b]), LOAD(&vx[b])), zero), one);
+                STORE_GROUP(&vf[b], less);
+                STORE_GROUP(&vx[b], _mm256_sub_epi8(LOAD(&vy[b]), LOAD(&vx[b])));
+            }
+            break;
+        case OPID_8xyE:
+            for (unsigned int b = 0; b < stride; b += 32){
+                STORE_GROUP(&vf[b], _mm256_and_si256(_mm256_srli_epi16(LOAD(&vx[b]), 7), one));
+                __m256i a = LOAD(&vx[b]);
+                STORE_GROUP(&vx[b], _mm256_add_epi8(a, a));
+            }
+            break;
+        case OPID_Annn:
+        {
+            __m256i nnn = _mm256_set1_epi16(instruction.nnn);
+            for (unsigned int b = 0; b < stride; b += 16){
+                STORE(&indexes[b], _mm256_blendv_epi8(LOAD(&indexes[b]), nnn, GROUP16(b)));
+            }
+        } break;
+        case OPID_Bnnn:
+        {
+            __m256i nnn = _mm256_set1_epi16(instruction.nnn);
+            for (unsigned int b = 0; b < stride; b += 16){
+                __m256i target = _mm256_add_epi16(nnn, WIDEN(&v0[b]));
+                STORE(&pcs[b], _mm256_blendv_epi8(LOAD(&pcs[b]), target, GROUP16(b)));
+            }
+        } break;
+        case OPID_Fx07:
+            for (unsigned int b = 0; b < stride; b += 32){
+                STORE_GROUP(&vx[b], LOAD(&delayTimer[b]));
+            }
+            break;
+        case OPID_Fx15:
+            for (unsigned int b = 0; b < stride; b += 32){
+                STORE_GROUP(&delayTimer[b], LOAD(&vx[b]));
+            }
+            break;
+        case OPID_Fx18:
+            for (unsigned int b = 0; b < stride; b += 32){
+                STORE_GROUP(&soundTimer[b], LOAD(&vx[b]));
+            }
+            break;
+        case OPID_Fx1E:
+            for (unsigned int b = 0; b < stride; b += 16){
+                __m256i add = _mm256_and_si256(WIDEN(&vx[b]), GROUP16(b));
+                STORE(&indexes[b], _mm256_add_epi16(LOAD(&indexes[b]), add));
+            }
+            break;
+        case OPID_Fx29:
+        {
+            __m256i font = _mm256_set1_epi16(FONTSET_START_ADDRESS);
+            __m256i five = _mm256_set1_epi16(5);
+            for (unsigned int b = 0; b < stride; b += 16){
+                __m256i address = _mm256_add_epi16(font, _mm256_mullo_epi16(WIDEN(&vx[b]), five));
+                STORE(&indexes[b], _mm256_blendv_epi8(LOAD(&indexes[b]), address, GROUP16(b)));
+            }
+        } break;
+        default:
+            // memory, stack, keypad, display and random opcodes: pc is already advanced
+            for (unsigned int lane = 0; lane < lanes; ++lane){
+                if (group[lane]){
+                    Execute(lane, instruction);
+                }
+            }
+            break;
+    }
+}
+
+#undef LOAD
+#undef STORE
+#undef STORE_GROUP
+#undef GROUP16
+#undef WIDEN
+
+#endif
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "chip8.hpp"
+
+// AVX2 is only compiled in for x86; it is used only if the CPU reports it at runtime
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CHIP8_LOCKSTEP_AVX2 1
+#endif
+
+/*
+ * Many copies of one ROM, stored structure-of-arrays: registers[r] is a row of
+ * one byte per lane, and pc, index, sp and the timers are arrays with one
+ * entry per lane. Machines that run the same program mostly sit at the same
+ * PC, so every step executes the shared opcode for all lanes at once. The
+ * register, timer, index and jump opcodes run 32 lanes per AVX2 instruction.
+ * Lanes that have drifted to another PC, and opcodes that touch per-lane memory,
+ * the keypad or the display, run through the scalar path one lane at a time.
+ *
+ * Every opcode must behave exactly like its OP_* counterpart in chip8.cpp, except
+ * that memory addresses and the stack pointer wrap instead of running off the
+ * lane's arrays.
+ */
+class Lockstep{
+    public:
+        // lanes machines, all with an empty program; lane i draws the same Cxkk bytes as Chip8(seed + i)
+        explicit Lockstep(unsigned int lanes, uint64_t seed = 1);
+        ~Lockstep();
+
+        // load the same ROM into every lane and reset them (seeds included); false if it does not fit
+        bool LoadROM(uint8_t const* data, size_t size);
+        // restart the Cxkk sequence of one lane, like Chip8::Seed
+        void Seed(unsigned int lane, uint64_t seed){ random[lane].Seed(seed); }
+
+        // execute `count` instructions on every lane
+        void Run(unsigned int count);
+        // count every lane's delay and sound timers down by one; call at 60 Hz of emulated time
+        void TickTimers();
+
+        // bit k set means key k of that lane is pressed
+        void SetKeys(unsigned int lane, uint16_t pressed){ keys[lane] = pressed; }
+
+        unsigned int Lanes() const { return lanes; }
+        // true if groups of lanes are executed with AVX2
+        bool Vectorized() const { return vectorized; }
+
+        uint16_t PC(unsigned int lane) const { return pc[lane]; }
+        uint16_t Index(unsigned int lane) const { return index[lane]; }
+        uint8_t Register(unsigned int lane, unsigned int r) const { return registers[r * stride + lane]; }
+        // rows of the lane's display, same layout as Chip8::video
+        uint64_t const* Video(unsigned int lane) const { return &video[lane * VIDEO_HEIGHT]; }
+        // same value Chip8::VideoHash gives for an equal display
+        uint64_t VideoHash(unsigned int lane) const;
+        // same test as Chip8::Halted
+        bool Halted(unsigned int lane) const;
+        // same test as Chip8::Blocked
+        bool Blocked(unsigned int lane) const { return keys[lane] == 0 && LaneInstruction(lane).id == OPID_Fx0A; }
+
+    private:
+        unsigned int lanes;
+        // lanes rounded up to a whole AVX2 register of bytes; padding lanes never execute
+        unsigned int stride;
+        bool vectorized;
+
+        // registers[r * stride + lane]
+        std::vector<uint8_t> registers;
+        std::vector<uint16_t> pc;
+        std::vector<uint16_t> index;
+        // stack[level * stride + lane]
+        std::vector<uint16_t> stack;
+        std::vector<uint8_t> sp;
+        std::vector<uint8_t> delayTimer;
+        std::vector<uint8_t> soundTimer;
+        std::vector<uint16_t> keys;
+        std::vector<Random> random;
+        // memory[lane * MEMORY_SIZE + address]
+        std::vector<uint8_t> memory;
+        // video[lane * VIDEO_HEIGHT + row]
+        std::vector<uint64_t> video;
+
+        // memory of a freshly loaded lane (font and ROM) and its decoded instructions
+        std::vector<uint8_t> image;
+        std::vector<Instruction> decoded;
+        // codeWritten[address] is nonzero once some lane changed that byte away from image;
+        // such lanes decode the instruction from their own memory
+        std::vector<uint8_t> codeWritten;
+        // used for its decode tables
+        std::unique_ptr<Chip8> decoder;
+        uint64_t seed;
+
+        // 0xFF for lanes still to run this step / in the current group, 0 otherwise
+        std::vector<uint8_t> pending;
+        std::vector<uint8_t> group;
+
+        // one instruction on every lane
+        void Step();
+        // instruction at lane's pc, from its own memory if another lane wrote over image there
+        Instruction LaneInstruction(unsigned int lane) const;
+        // pc += 2 and run one instruction on one lane
+        void StepLane(unsigned int lane, Instruction const& instruction);
+        // run an already fetched instruction on one lane
+        void Execute(unsigned int lane, Instruction const& instruction);
+        // pc += 2 and run instruction on every lane in group with scalar code
+        void StepGroupScalar(Instruction const& instruction);
+#ifdef CHIP8_LOCKSTEP_AVX2
+        // same with AVX2; opcodes it cannot vectorize fall back to Execute per lane
+        void StepGroupAVX2(Instruction const& instruction);
+#endif
+        // memory[lane][address] = value, remembering bytes that no longer match image
+        void WriteMemory(unsigned int lane, unsigned int address, uint8_t value);
+
+        Lockstep(Lockstep const&);
+        Lockstep& operator=(Lockstep const&);
+};
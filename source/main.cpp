@@ -1,48 +1,314 @@
+#include <atomic>
 #include <chrono>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include "platform.hpp"
 #include "chip8.hpp"
+#include "movie.hpp"
+#include "pacer.hpp"
+#include "profile.hpp"
+#include "rewind.hpp"
+#include "scheduler.hpp"
+#include "sound.hpp"
+#include "trace.hpp"
+#include "triplebuffer.hpp"
+
+// number of instructions kept by --trace
+const size_t TRACE_CAPACITY = 1 << 16;
+// rewind history: 6 MB of states, at most an hour of frames, a full state every 5 seconds.
+// An hour of CHIP-8 keyframes is 4.5 MB; an XO-CHIP one is 15 times that, so its history is shorter.
+const size_t REWIND_BYTES = 6 << 20;
+const unsigned int REWIND_FRAMES = 60 * 60 * TIMER_HZ;
+const unsigned int REWIND_KEYFRAME_INTERVAL = 5 * TIMER_HZ;
+// longest the render thread sleeps on input while the machine waits for a key
+const int BLOCKED_WAIT_MS = 250;
+
+// A finished frame as the emulation thread hands it to the render thread
+struct Frame{
+    // copy of Chip8::video and Chip8::Hires() after the frame ran
+    uint64_t video[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS];
+    bool hires;
+};
+
+// State shared by the render (main) thread and the emulation thread. Everything
+// here is lock-free; neither thread ever waits for the other.
+struct Shared{
+    // render -> emulation: bit k is CHIP-8 key k
+    std::atomic<uint16_t> keys{0};
+    // render -> emulation: Backspace is held
+    std::atomic<bool> rewindHeld{false};
+    // render -> emulation: the window was closed
+    std::atomic<bool> quit{false};
+    // emulation -> render: Fx0A is waiting for a key (see Chip8::Blocked), so the display
+    // cannot change before the next input; set after the frame is published
+    std::atomic<bool> blocked{false};
+    // emulation -> render: the newest finished frame
+    TripleBuffer<Frame> frames;
+};
+
+static void usage(char const* name){
+    std::cerr << "Usage: " << name << " <Scale> <Speed> <ROM> [--trace FILE] [--seed N] [--record FILE] [--profile FILE] [--profile-folded FILE] [--vsync] [--variant chip8|schip|xochip] [--mute]"<<std::endl; 
+    std::exit(EXIT_FAILURE);
+}
+
+static void PrintPacing(char const* name, PacingStats const& stats){
+    std::cerr << name << " pacing: " << stats.frames << " frames, " << stats.mean << " ms mean, "
+              << stats.jitter << " ms jitter, " << stats.min << " - " << stats.max << " ms, "
+              << stats.late << " late" << std::endl;
+}
 
 int main(int argc, char** argv){
-    // if the argument is not 4, error
-    if (argc != 4){
-        std::cerr << "Usage: " << argv[0] << " <Scale> <Delay> <ROM>"<<std::endl; 
-        std::exit(EXIT_FAILURE);
+    // need at least scale, speed and ROM
+    if (argc < 4){
+        usage(argv[0]);
     }
 
     int videoScale = std::stoi(argv[1]);
-    int cycleDelay = std::stoi(argv[2]);
+    // instructions per second of emulated time
+    int speed = std::stoi(argv[2]);
     char const* romName = argv[3];
+    // file the instruction trace is written to, if tracing
+    char const* traceName = nullptr;
+    // Cxkk seed; without --seed every run is different
+    bool seeded = false;
+    uint64_t seed = 0;
+    // movie the key presses are recorded into, if recording
+    char const* recordName = nullptr;
+    // files the profile report and its folded stacks are written to at exit, if profiling
+    char const* profileName = nullptr;
+    char const* foldedName = nullptr;
+    // present in step with the display instead of pacing the render thread with a timer
+    bool vsync = false;
+    // instruction set the ROM is written for
+    Variant variant = VARIANT_CHIP8;
+    // run without opening an audio device
+    bool mute = false;
+
+    for (int i = 4; i < argc; ++i){
+        if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc){
+            traceName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+            seeded = true;
+            seed = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc){
+            recordName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc){
+            profileName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--profile-folded") == 0 && i + 1 < argc){
+            foldedName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--vsync") == 0){
+            vsync = true;
+        }
+        else if (std::strcmp(argv[i], "--mute") == 0){
+            mute = true;
+        }
+        else if (std::strcmp(argv[i], "--variant") == 0 && i + 1 < argc){
+            if (!Chip8::VariantFromName(argv[++i], variant)){
+                usage(argv[0]);
+            }
+        }
+        else{
+            usage(argv[0]);
+        }
+    }
 
-    Platform platform("CHIP-8 Emulator by Peter Lee", VIDEO_WIDTH * videoScale, VIDEO_HEIGHT * videoScale, VIDEO_WIDTH, VIDEO_HEIGHT);
+    // declared before platform so it outlives the audio thread that reads it
+    Sound sound;
+    // the texture is always hi-res; a low-resolution frame is drawn with 2 x 2 texels per pixel
+    Platform platform("CHIP-8 Emulator by Peter Lee", VIDEO_WIDTH * videoScale, VIDEO_HEIGHT * videoScale, HIRES_WIDTH, HIRES_HEIGHT, vsync);
+
+    bool audio = !mute && platform.OpenAudio(sound);
+    if (!mute && !audio){
+        std::cerr << "No audio device, running without sound" << std::endl;
+    }
 
     Chip8 chip8;
+    if (seeded){
+        chip8.Seed(seed);
+    }
+    chip8.SetVariant(variant);
     chip8.LoadROM(romName);
 
-    // pitch of video is size of a row
-    int videoPitch = sizeof(chip8.video[0]) * VIDEO_WIDTH;
+    Trace* trace = nullptr;
+    if (traceName != nullptr){
+        trace = &chip8.EnableTrace(TRACE_CAPACITY);
+        trace->DumpOnCrash(traceName);
+    }
+
+    Profile* profile = nullptr;
+    if (profileName != nullptr || foldedName != nullptr){
+        profile = &chip8.EnableProfile();
+    }
+
+    Scheduler scheduler(speed);
+    // every frame is recorded; holding Backspace plays them back in reverse
+    Rewind rewind(REWIND_BYTES, REWIND_FRAMES, REWIND_KEYFRAME_INTERVAL);
+    rewind.Push(chip8);
+    // a movie is one unbroken timeline, so rewinding is off while recording
+    Movie movie(speed);
+
+    Shared shared;
+    // length of one frame
+    std::chrono::nanoseconds frameLength(1000000000 / TIMER_HZ);
+    FramePacer emulationPacer(frameLength);
+    FramePacer renderPacer(frameLength);
+
+    // Emulation thread: owns chip8 and everything that touches it. Runs one frame (or
+    // steps one frame back) every 1/60 s and publishes the display whenever it changed,
+    // so a slow present on the render thread never holds emulation up and vice versa.
+    std::thread emulation([&](){
+        while (!shared.quit.load(std::memory_order_relaxed)){
+            uint16_t keys = shared.keys.load(std::memory_order_relaxed);
+            for (unsigned int k = 0; k < KEY_COUNT; ++k){
+                chip8.keypad[k] = (keys >> k) & 1u;
+            }
+
+            // a whole frame of instructions, or one frame back in time. A blocked machine
+            // returns from RunFrame at once, but its timers still tick.
+            bool rewinding = shared.rewindHeld.load(std::memory_order_relaxed) && recordName == nullptr;
+            if (rewinding){
+                rewind.StepBack(chip8);
+                if (audio){
+                    sound.Advance(chip8, SOUND_SUBFRAMES);
+                }
+            }
+            else{
+                if (recordName != nullptr){
+                    movie.Record(chip8, scheduler.Frames());
+                }
+                if (audio){
+                    scheduler.RunFrame(chip8, sound);
+                }
+                else{
+                    scheduler.RunFrame(chip8);
+                }
+                rewind.Push(chip8);
+            }
+
+            // only hand a frame over when drawing, clearing, scrolling (or a rewind) changed something
+            unsigned int firstRow = 0;
+            unsigned int lastRow = 0;
+            if (chip8.TakeDirtyRows(firstRow, lastRow)){
+                Frame& frame = shared.frames.Back();
+                std::memcpy(frame.video, chip8.video, sizeof(chip8.video));
+                frame.hires = chip8.Hires();
+                shared.frames.Publish();
+            }
+            // while rewinding the display keeps changing, so the render thread must not sleep
+            shared.blocked.store(chip8.Blocked() && !rewinding, std::memory_order_release);
 
-    // store last Cycletime to calculate cycle
-    auto lastCycleTime = std::chrono::high_resolution_clock::now();
+            emulationPacer.Wait();
+        }
+    });
+
+    // Render thread (this one): input and presenting only, once per frame.
+    // RGBA copy of the display handed to SDL, and the frame it was expanded from
+    uint32_t pixels[HIRES_WIDTH * HIRES_HEIGHT]{};
+    Frame shown{};
+    // pitch of video is size of a row
+    int videoPitch = sizeof(pixels[0]) * HIRES_WIDTH;
+    // keypad as Platform reports it; sent to the emulation thread as a bitmask
+    uint8_t keypad[KEY_COUNT]{};
     bool quit = false;
 
     // while program is not quitting
     while (!quit){
         // if ProcessInput returns 1, keypress is done
-        quit = platform.ProcessInput(chip8.keypad);
+        quit = platform.ProcessInput(keypad);
 
-        auto currentTime = std::chrono::high_resolution_clock::now();
-
-        //calculate delaytime (current cycle)
-        float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count();
+        uint16_t keys = 0;
+        for (unsigned int k = 0; k < KEY_COUNT; ++k){
+            keys |= (keypad[k] != 0 ? 1u : 0u) << k;
+        }
+        shared.keys.store(keys, std::memory_order_relaxed);
+        shared.rewindHeld.store(platform.RewindHeld(), std::memory_order_relaxed);
 
-        if (dt > cycleDelay){
-            lastCycleTime = currentTime;
+        // read before taking the frame: any frame published before blocked was set is taken below
+        bool blocked = shared.blocked.load(std::memory_order_acquire);
 
-            chip8.Cycle();
+        // frames published in between are skipped, so the changed rows are found by
+        // comparing with what is on screen rather than taken from the emulation thread
+        bool dirty = false;
+        unsigned int firstRow = 0;
+        unsigned int lastRow = 0;
+        if (shared.frames.Acquire()){
+            Frame const& frame = shared.frames.Front();
+            // a new resolution redraws everything
+            bool resized = frame.hires != shown.hires;
+            shown.hires = frame.hires;
+            for (unsigned int y = 0; y < HIRES_HEIGHT; ++y){
+                bool changed = resized;
+                for (unsigned int plane = 0; plane < PLANE_COUNT; ++plane){
+                    changed = changed || std::memcmp(frame.video[plane][y], shown.video[plane][y], sizeof(frame.video[plane][y])) != 0;
+                    std::memcpy(shown.video[plane][y], frame.video[plane][y], sizeof(frame.video[plane][y]));
+                }
+                if (changed){
+                    if (!dirty){
+                        firstRow = y;
+                    }
+                    dirty = true;
+                    lastRow = y;
+                }
+            }
+        }
 
-            platform.Update(chip8.video, videoPitch);
+        if (dirty){
+            Chip8::ExpandVideo(shown.video, shown.hires, pixels, firstRow, lastRow);
+            // from display rows to texture rows
+            if (!shown.hires){
+                firstRow = 2 * firstRow;
+                lastRow = lastRow < VIDEO_HEIGHT ? 2 * lastRow + 1 : HIRES_HEIGHT - 1;
+            }
+        }
+        if (vsync){
+            // presenting blocks until the next refresh, which paces this loop
+            platform.Update(pixels, videoPitch, firstRow, dirty ? lastRow - firstRow + 1 : 0);
+            renderPacer.Mark();
+        }
+        else{
+            // only touch the GPU when the display changed or the window needs repainting
+            if (dirty || platform.TakeExposed()){
+                platform.Update(pixels, videoPitch, firstRow, dirty ? lastRow - firstRow + 1 : 0);
+            }
+            if (blocked && !dirty && !quit){
+                // nothing can change before a key is pressed: sleep on input instead of every frame
+                quit = platform.ProcessInput(keypad, BLOCKED_WAIT_MS);
+                renderPacer.Restart();
+            }
+            else{
+                renderPacer.Wait();
+            }
         }
     }
+
+    shared.quit.store(true, std::memory_order_relaxed);
+    emulation.join();
+    platform.CloseAudio();
+
+    PrintPacing("emulation", emulationPacer.Stats());
+    PrintPacing("render", renderPacer.Stats());
+    if (audio){
+        std::cerr << "sound: " << sound.Edges() << " edges, " << sound.Resyncs() << " resyncs, "
+                  << sound.Overflows() << " late" << std::endl;
+    }
+
+    if (trace != nullptr){
+        trace->Dump(traceName);
+    }
+    if (profileName != nullptr && !profile->Report(profileName)){
+        std::cerr << "Could not write profile " << profileName << std::endl;
+    }
+    if (foldedName != nullptr && !profile->Folded(foldedName)){
+        std::cerr << "Could not write profile " << foldedName << std::endl;
+    }
+    if (recordName != nullptr && !movie.Save(recordName)){
+        std::cerr << "Could not write movie " << recordName << std::endl;
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include "movie.hpp"
+#include "chip8.hpp"
+#include "scheduler.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+// File layout: MovieHeader, then eventCount InputEvents, then keyframeCount keyframes, each
+// a uint64_t frame and a state of Chip8State::Size() bytes.
+// Everything is in host byte order, like Chip8State.
+struct MovieHeader{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t instructionsPerSecond;
+    uint32_t keyframeInterval;
+    uint64_t frames;
+    uint64_t eventCount;
+    uint64_t keyframeCount;
+};
+
+static uint16_t KeyMask(uint8_t const* keypad){
+    uint16_t keys = 0;
+    for (unsigned int k = 0; k < KEY_COUNT; ++k){
+        if (keypad[k]){
+            keys |= 1u << k;
+        }
+    }
+    return keys;
+}
+
+Movie::Movie(unsigned int instructionsPerSecond, unsigned int keyframeInterval)
+    : instructionsPerSecond(instructionsPerSecond),
+      keyframeInterval(keyframeInterval > 0 ? keyframeInterval : 1)
+    {
+}
+
+void Movie::Record(Chip8 const& chip8, uint64_t frame){
+    if (frame % keyframeInterval == 0 || keyframes.empty()){
+        MovieKeyframe keyframe = { frame, StateBuffer(chip8.StateSize()) };
+        chip8.SaveState(keyframe.state.State());
+        keyframes.push_back(keyframe);
+    }
+
+    uint16_t keys = KeyMask(chip8.keypad);
+    if (events.empty() || events.back().keys != keys){
+        InputEvent event = { (uint32_t)frame, keys, 0 };
+        events.push_back(event);
+    }
+    frames = frame + 1;
+}
+
+bool Movie::Save(char const* filename) const{
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()){
+        return false;
+    }
+
+    MovieHeader header = { MOVIE_MAGIC, MOVIE_VERSION, instructionsPerSecond, keyframeInterval,
+                           frames, events.size(), keyframes.size() };
+    file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    file.write(reinterpret_cast<char const*>(events.data()), events.size() * sizeof(InputEvent));
+    for (MovieKeyframe const& keyframe : keyframes){
+        file.write(reinterpret_cast<char const*>(&keyframe.frame), sizeof(keyframe.frame));
+        file.write(reinterpret_cast<char const*>(&keyframe.state.State()), keyframe.state.State().Size());
+    }
+    return file.good();
+}
+
+bool Movie::Load(char const* filename){
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()){
+        return false;
+    }
+
+    MovieHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || header.magic != MOVIE_MAGIC || header.version != MOVIE_VERSION || header.keyframeInterval == 0){
+        return false;
+    }
+
+    // the counts come from the file: check they fit in what is left of it before allocating
+    std::streamoff start = file.tellg();
+    file.seekg(0, std::ios::end);
+    uint64_t remaining = static_cast<uint64_t>(file.tellg() - start);
+    file.seekg(start);
+    if (header.eventCount > remaining / sizeof(InputEvent)){
+        return false;
+    }
+    remaining -= header.eventCount * sizeof(InputEvent);
+    if (header.keyframeCount > remaining / (sizeof(uint64_t) + sizeof(Chip8State))){
+        return false;
+    }
+
+    std::vector<InputEvent> newEvents(header.eventCount);
+    if (!file.read(reinterpret_cast<char*>(newEvents.data()), newEvents.size() * sizeof(InputEvent))){
+        return false;
+    }
+    std::vector<MovieKeyframe> newKeyframes;
+    for (uint64_t k = 0; k < header.keyframeCount; ++k){
+        // the fixed part of the state says how much memory follows it
+        MovieKeyframe keyframe = { 0, StateBuffer(sizeof(Chip8State)) };
+        Chip8State& state = keyframe.state.State();
+        if (!file.read(reinterpret_cast<char*>(&keyframe.frame), sizeof(keyframe.frame))
+            || !file.read(reinterpret_cast<char*>(&state), sizeof(Chip8State)) || state.memorySize > XO_MEMORY_SIZE){
+            return false;
+        }
+        StateBuffer whole(state.Size());
+        memcpy(&whole.State(), &state, sizeof(Chip8State));
+        if (!file.read(reinterpret_cast<char*>(whole.State().Memory()), state.memorySize)){
+            return false;
+        }
+        keyframe.state = whole;
+        newKeyframes.push_back(keyframe);
+    }
+
+    instructionsPerSecond = header.instructionsPerSecond;
+    keyframeInterval = header.keyframeInterval;
+    frames = header.frames;
+    events.swap(newEvents);
+    keyframes.swap(newKeyframes);
+    nextEvent = 0;
+    return true;
+}
+
+void Movie::Apply(Chip8& chip8, uint64_t frame){
+    // only touch the keypad on frames where it changed
+    if (nextEvent >= events.size() || events[nextEvent].frame > frame){
+        return;
+    }
+    uint16_t keys = 0;
+    while (nextEvent < events.size() && events[nextEvent].frame <= frame){
+        keys = events[nextEvent].keys;
+        ++nextEvent;
+    }
+    for (unsigned int k = 0; k < KEY_COUNT; ++k){
+        chip8.keypad[k] = (keys >> k) & 1u;
+    }
+}
+
+bool Movie::Seek(Chip8& chip8, Scheduler& scheduler, uint64_t frame){
+    if (keyframes.empty()){
+        return false;
+    }
+    if (frame > frames){
+        frame = frames;
+    }
+
+    // newest keyframe at or before frame
+    size_t k = keyframes.size() - 1;
+    while (k > 0 && keyframes[k].frame > frame){
+        --k;
+    }
+    if (!chip8.LoadState(keyframes[k].state.State())){
+        return false;
+    }
+    uint64_t start = keyframes[k].frame;
+    scheduler.SeekFrame(start);
+
+    // the keyframe already holds the keypad of its frame; continue from its first event
+    InputEvent key = { (uint32_t)start, 0, 0 };
+    nextEvent = std::lower_bound(events.begin(), events.end(), key,
+        [](InputEvent const& a, InputEvent const& b){ return a.frame < b.frame; }) - events.begin();
+
+    for (uint64_t f = start; f < frame; ++f){
+        Apply(chip8, f);
+        scheduler.RunFrame(chip8);
+    }
+    // same as a keyframe: the frame's own keypad is already in place
+    Apply(chip8, frame);
+    return true;
+}
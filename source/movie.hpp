@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "savestate.hpp"
+
+class Chip8;
+class Scheduler;
+
+// first four bytes of a movie file: "C8MV" read as a little-endian word
+const uint32_t MOVIE_MAGIC = 0x564D3843;
+// (2: keyframes hold version 3 states; 3: version 4 states, each as large as its memory)
+const uint32_t MOVIE_VERSION = 3;
+// frames between keyframes unless the recorder asks otherwise (10 seconds)
+const unsigned int DEFAULT_MOVIE_KEYFRAME_INTERVAL = 600;
+
+// The keypad from `frame` on, until the next event. Bit k is key k.
+struct InputEvent{
+    uint32_t frame;
+    uint16_t keys;
+    uint16_t unused;
+};
+
+// Whole machine at the start of `frame`: its keypad set, none of its instructions run yet
+struct MovieKeyframe{
+    uint64_t frame;
+    StateBuffer state;
+};
+
+/*
+ * A recorded run: only the frames where the keypad changed, plus a full state
+ * every `keyframeInterval` frames. Keyframe 0 holds the ROM and the random
+ * seed, so a movie replays without the ROM file, and Seek can jump to any frame
+ * by restoring the nearest keyframe instead of running from boot.
+ *
+ * Replaying needs the same instructions per second as the recording, since
+ * that decides which instruction every key press lands on.
+ */
+class Movie{
+    public:
+        explicit Movie(unsigned int instructionsPerSecond = 0, unsigned int keyframeInterval = DEFAULT_MOVIE_KEYFRAME_INTERVAL);
+
+        // recording: call before running `frame`, with the keypad that frame sees. Frames must come in order.
+        void Record(Chip8 const& chip8, uint64_t frame);
+
+        bool Save(char const* filename) const;
+        // false if the file is missing, truncated or not a movie of this version
+        bool Load(char const* filename);
+
+        // replaying: set the keypad for `frame`; call before running it, frames in order
+        void Apply(Chip8& chip8, uint64_t frame);
+        // put chip8 and scheduler at the start of `frame` (not past the end), with that frame's
+        // keypad applied; false if the movie is empty
+        bool Seek(Chip8& chip8, Scheduler& scheduler, uint64_t frame);
+
+        // number of frames recorded
+        uint64_t Frames() const { return frames; }
+        unsigned int InstructionsPerSecond() const { return instructionsPerSecond; }
+        size_t Events() const { return events.size(); }
+        size_t Keyframes() const { return keyframes.size(); }
+
+    private:
+        unsigned int instructionsPerSecond;
+        unsigned int keyframeInterval;
+        uint64_t frames{};
+
+        std::vector<InputEvent> events;
+        std::vector<MovieKeyframe> keyframes;
+        // replay position: first event not applied yet
+        size_t nextEvent{};
+};
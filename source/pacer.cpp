@@ -0,0 +1,93 @@
+#include "pacer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+// a frame ending this much after its deadline counts as late
+const std::chrono::microseconds LATE_THRESHOLD(1000);
+// bounds of the spin margin; it starts at the maximum until sleeps have been measured
+const std::chrono::microseconds MIN_SPIN_MARGIN(100);
+const std::chrono::microseconds MAX_SPIN_MARGIN(2000);
+// weight of the newest oversleep in the moving average
+const double OVERSLEEP_WEIGHT = 1.0 / 8;
+
+FramePacer::FramePacer(std::chrono::nanoseconds period)
+    : period(period),
+      deadline(Clock::now() + period),
+      lastFrame(Clock::now()),
+      spinMargin(MAX_SPIN_MARGIN),
+      oversleep(std::chrono::duration<double, std::nano>(MAX_SPIN_MARGIN).count() / 2)
+{
+}
+
+void FramePacer::Wait(){
+    Clock::time_point now = Clock::now();
+
+    if (now < deadline - spinMargin){
+        Clock::time_point wakeTarget = deadline - spinMargin;
+        std::this_thread::sleep_until(wakeTarget);
+        now = Clock::now();
+
+        // margin = twice the typical oversleep, so a normal wake-up still lands before the deadline
+        double late = std::chrono::duration<double, std::nano>(now - wakeTarget).count();
+        oversleep += (std::max(late, 0.0) - oversleep) * OVERSLEEP_WEIGHT;
+        spinMargin = std::chrono::nanoseconds((int64_t)(2 * oversleep));
+        spinMargin = std::max<std::chrono::nanoseconds>(MIN_SPIN_MARGIN, std::min<std::chrono::nanoseconds>(MAX_SPIN_MARGIN, spinMargin));
+    }
+    while (now < deadline){
+        std::this_thread::yield();
+        now = Clock::now();
+    }
+
+    if (now - deadline > LATE_THRESHOLD){
+        ++late;
+    }
+    Record(now);
+
+    deadline += period;
+    // more than a period behind: carry on from now
+    if (now > deadline){
+        deadline = now + period;
+    }
+}
+
+void FramePacer::Mark(){
+    Clock::time_point now = Clock::now();
+    if (now - lastFrame > period + LATE_THRESHOLD){
+        ++late;
+    }
+    Record(now);
+}
+
+void FramePacer::Restart(){
+    lastFrame = Clock::now();
+    deadline = lastFrame + period;
+}
+
+void FramePacer::Record(Clock::time_point now){
+    double ms = std::chrono::duration<double, std::milli>(now - lastFrame).count();
+    lastFrame = now;
+
+    if (frames == 0 || ms < minTime){
+        minTime = ms;
+    }
+    if (frames == 0 || ms > maxTime){
+        maxTime = ms;
+    }
+    ++frames;
+    sum += ms;
+    sumOfSquares += ms * ms;
+}
+
+PacingStats FramePacer::Stats() const{
+    PacingStats stats{};
+    stats.frames = frames;
+    stats.late = late;
+    if (frames > 0){
+        stats.mean = sum / frames;
+        stats.jitter = std::sqrt(std::max(0.0, sumOfSquares / frames - stats.mean * stats.mean));
+        stats.min = minTime;
+        stats.max = maxTime;
+    }
+    return stats;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Frame time statistics collected by FramePacer, in milliseconds
+struct PacingStats{
+    uint64_t frames;
+    double mean;
+    // standard deviation of the frame time
+    double jitter;
+    double min;
+    double max;
+    // frames that ended more than LATE_THRESHOLD after their deadline
+    uint64_t late;
+};
+
+/*
+ * Paces a loop to a fixed period without burning a core. Wait() sleeps until
+ * shortly before the next deadline and spins (yielding) for the rest, because
+ * the OS usually wakes a sleeping thread a little late. The spin margin follows
+ * how late sleeps have actually been woken, so on a quiet machine almost all
+ * of the wait is spent asleep.
+ *
+ * Deadlines are absolute (start + n * period), so small errors do not add up.
+ * A loop that falls more than a period behind starts over from now instead of
+ * running a burst of frames to catch up.
+ */
+class FramePacer{
+    public:
+        explicit FramePacer(std::chrono::nanoseconds period);
+
+        // block until the current frame's deadline, then start the next frame
+        void Wait();
+        // end a frame that was paced by something else (e.g. a vsync'd present); only records its time
+        void Mark();
+        // start over from now after the loop deliberately stopped (e.g. slept on input); the gap
+        // is not recorded as a frame
+        void Restart();
+
+        PacingStats Stats() const;
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        std::chrono::nanoseconds period;
+        Clock::time_point deadline;
+        Clock::time_point lastFrame;
+        // time before a deadline at which sleeping stops and spinning starts
+        std::chrono::nanoseconds spinMargin;
+        // moving average of how late sleep_until returns
+        double oversleep;
+
+        uint64_t frames{};
+        // running sums of frame times in ms, for mean and jitter
+        double sum{};
+        double sumOfSquares{};
+        double minTime{};
+        double maxTime{};
+        uint64_t late{};
+
+        // record the frame that ends at now
+        void Record(Clock::time_point now);
+};
@@ -1,16 +1,28 @@
 #include "platform.hpp"
+#include "sound.hpp"
 #include <SDL2/SDL.h>
 
+// requested output format; SDL may pick another rate, which Sound follows.
+// 512 samples is about 12 ms per callback.
+const int SOUND_SAMPLE_RATE = 44100;
+const int SOUND_BUFFER_SAMPLES = 512;
+
+static void AudioCallback(void* userdata, Uint8* stream, int length){
+    static_cast<Sound*>(userdata)->Mix(reinterpret_cast<int16_t*>(stream), length / sizeof(int16_t));
+}
+
 // constructor
-Platform::Platform(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight){
+Platform::Platform(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight, bool vsync)
+    : textureWidth(textureWidth)
+    {
     // initialize SDL library
     SDL_Init(SDL_INIT_VIDEO);
 
     // create a visible window at (0,0) on screen, with size of windowWidth*windowHeight
     window = SDL_CreateWindow(title, 0, 0, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
 
-    // create a renderer with the window created above
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    // create a renderer with the window created above; with vsync, presenting waits for the refresh
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
 
     // texture using pixelformat rgba8888
     texture = SDL_CreateTexture(
@@ -18,17 +30,21 @@ Platform::Platform(char const* title, int windowWidth, int windowHeight, int tex
     );
 }
 
-// deconstructor; safely deallocate texture, renderer, and window
+// deconstructor; stop audio, then safely deallocate texture, renderer, and window
 Platform::~Platform(){
+    CloseAudio();
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 }
 
-void Platform::Update(void const* buffer, int pitch){
-    // update texture from buffer
-    SDL_UpdateTexture(texture, nullptr, buffer, pitch);
+void Platform::Update(void const* buffer, int pitch, int firstRow, int rowCount){
+    // update only the rows that changed
+    if (rowCount > 0){
+        SDL_Rect rows = {0, firstRow, textureWidth, rowCount};
+        SDL_UpdateTexture(texture, &rows, static_cast<uint8_t const*>(buffer) + firstRow * pitch, pitch);
+    }
     // clear render on screen
     SDL_RenderClear(renderer);
     // copy entire texture to destination
@@ -37,15 +53,57 @@ void Platform::Update(void const* buffer, int pitch){
     SDL_RenderPresent(renderer);
 }
 
-bool Platform::ProcessInput(uint8_t* keys){
+bool Platform::OpenAudio(Sound& sound){
+    // audio is optional, so it is started apart from SDL_Init and a failure leaves the video running
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0){
+        return false;
+    }
+
+    SDL_AudioSpec wanted{};
+    wanted.freq = SOUND_SAMPLE_RATE;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = 1;
+    wanted.samples = SOUND_BUFFER_SAMPLES;
+    wanted.callback = AudioCallback;
+    wanted.userdata = &sound;
+    SDL_AudioSpec obtained{};
+    audioDevice = SDL_OpenAudioDevice(nullptr, 0, &wanted, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (audioDevice == 0){
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return false;
+    }
+
+    // the device opens paused, so the rate is set before the first callback
+    sound.SetSampleRate(obtained.freq);
+    SDL_PauseAudioDevice(audioDevice, 0);
+    return true;
+}
+
+void Platform::CloseAudio(){
+    if (audioDevice != 0){
+        // waits for a running callback to return
+        SDL_CloseAudioDevice(audioDevice);
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        audioDevice = 0;
+    }
+}
+
+bool Platform::TakeExposed(){
+    bool wasExposed = exposed;
+    exposed = false;
+    return wasExposed;
+}
+
+bool Platform::ProcessInput(uint8_t* keys, int timeoutMs){
     // initialize quit variable to false
     bool quit = false;
 
     // create event object
     SDL_Event event;
 
-    // while there is a pending event, keep looping
-    while(SDL_PollEvent(&event)){
+    // while there is a pending event, keep looping; the first one may be waited for
+    bool pending = timeoutMs > 0 ? SDL_WaitEventTimeout(&event, timeoutMs) != 0 : SDL_PollEvent(&event) != 0;
+    for (; pending; pending = SDL_PollEvent(&event) != 0){
         switch(event.type){
             //case for cmd-Q
             case SDL_QUIT:
@@ -53,6 +111,14 @@ bool Platform::ProcessInput(uint8_t* keys){
                 quit = true;
             } break;
 
+            // window was uncovered or restored, the screen has to be drawn again
+            case SDL_WINDOWEVENT:
+            {
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED){
+                    exposed = true;
+                }
+            } break;
+
             // case for when key is pressed down
             case SDL_KEYDOWN:
             {
@@ -142,6 +208,12 @@ bool Platform::ProcessInput(uint8_t* keys){
                     {
                         keys[15] = 1;
                     } break;
+
+                    // not a CHIP-8 key: step back through history while held
+                    case SDLK_BACKSPACE:
+                    {
+                        rewindHeld = true;
+                    } break;
                 }
             } break;
 
@@ -228,6 +300,11 @@ bool Platform::ProcessInput(uint8_t* keys){
                     {
                         keys[15] = 0;
                     } break;
+
+                    case SDLK_BACKSPACE:
+                    {
+                        rewindHeld = false;
+                    } break;
                 }
             } break;
         }
@@ -5,17 +5,37 @@
 class SDL_Window;
 class SDL_Renderer;
 class SDL_Texture;
+class Sound;
 
 class Platform{
     public:
-        Platform(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight);
+        // with vsync, Update blocks until the display's next refresh
+        Platform(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight, bool vsync = false);
         ~Platform();
-        void Update(void const* buffer, int pitch);
-        bool ProcessInput(uint8_t* keys);
+        // upload rowCount rows of buffer starting at firstRow (0 rows is fine) and present
+        void Update(void const* buffer, int pitch, int firstRow, int rowCount);
+        // handle pending events; returns true on quit. With timeoutMs > 0, first sleep until an
+        // event arrives or the timeout passes.
+        bool ProcessInput(uint8_t* keys, int timeoutMs = 0);
+        // true once after the window was uncovered and has to be presented again
+        bool TakeExposed();
+        // true while Backspace is held down
+        bool RewindHeld() const { return rewindHeld; }
+        // start playing sound from SDL's audio thread, which calls sound.Mix until CloseAudio;
+        // returns false if there is no audio device. SDL_AUDIODRIVER=dummy gives one without output.
+        bool OpenAudio(Sound& sound);
+        // stop the audio thread; sound is not touched after this returns
+        void CloseAudio();
 
     private:
         SDL_Window* window{};
         SDL_Renderer* renderer{};
         SDL_Texture* texture{};
+        // SDL_AudioDeviceID, 0 while no audio is playing
+        uint32_t audioDevice{};
+        int textureWidth;
+        // set by ProcessInput when SDL reports the window needs repainting
+        bool exposed{};
+        bool rewindHeld{};
 
 };
\ No newline at end of file
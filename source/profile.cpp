@@ -0,0 +1,201 @@
+#include "profile.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+// caller[] of a routine nobody called (yet)
+const uint16_t NO_CALLER = 0xFFFF;
+
+static char const* const OP_NAMES[OPID_COUNT] = {
+    "NULL", "00E0", "00EE", "1nnn", "2nnn", "3xkk", "4xkk", "5xy0", "6xkk", "7xkk",
+    "8xy0", "8xy1", "8xy2", "8xy3", "8xy4", "8xy5", "8xy6", "8xy7", "8xyE", "9xy0",
+    "Annn", "Bnnn", "Cxkk", "Dxyn", "Ex9E", "ExA1", "Fx07", "Fx0A", "Fx15", "Fx18",
+    "Fx1E", "Fx29", "Fx33", "Fx55", "Fx65", "00Cn", "00FB", "00FC", "00FD", "00FE",
+    "00FF", "Fx30", "Fx75", "Fx85", "00Dn", "5xy2", "5xy3", "F000", "Fx01", "F002",
+    "Fx3A"
+};
+
+Profile::Profile(){
+    Reset();
+}
+
+void Profile::Reset(){
+    std::memset(opcodes, 0, sizeof(opcodes));
+    std::memset(addresses, 0, sizeof(addresses));
+    std::memset(idOf, 0, sizeof(idOf));
+    std::memset(routineOf, 0, sizeof(routineOf));
+    std::fill(caller, caller + XO_MEMORY_SIZE, NO_CALLER);
+    routines[0] = START_ADDRESS;
+    depth = 0;
+    draws = 0;
+    drawNanoseconds = 0;
+    waits = 0;
+    blocked = 0;
+    waitNanoseconds = 0;
+    waiting = false;
+    skipped = 0;
+}
+
+char const* Profile::OpName(uint8_t id){
+    return id < OPID_COUNT ? OP_NAMES[id] : "?";
+}
+
+void Profile::Call(uint16_t target){
+    target &= XO_MEMORY_SIZE - 1;
+    // the first caller wins, so a routine never ends up as its own ancestor
+    if (caller[target] == NO_CALLER && target != routines[0]){
+        caller[target] = routines[depth];
+    }
+    // deeper than the real stack: the program overflowed it; keep counting in the innermost routine
+    if (depth < STACK_LEVEL){
+        routines[++depth] = target;
+    }
+}
+
+uint64_t Profile::Instructions() const{
+    uint64_t total = 0;
+    for (unsigned int id = 0; id < OPID_COUNT; ++id){
+        total += opcodes[id];
+    }
+    return total;
+}
+
+static double Percent(uint64_t part, uint64_t total){
+    return total > 0 ? 100.0 * part / total : 0;
+}
+
+bool Profile::Report(char const* filename, unsigned int hotCount) const{
+    std::ofstream file(filename);
+    if (!file){
+        return false;
+    }
+
+    uint64_t total = Instructions();
+    file << std::fixed << std::setprecision(2);
+    file << "instructions: " << total << std::endl;
+
+    // opcode histogram, most executed first
+    std::vector<unsigned int> ids;
+    for (unsigned int id = 0; id < OPID_COUNT; ++id){
+        if (opcodes[id] > 0){
+            ids.push_back(id);
+        }
+    }
+    std::stable_sort(ids.begin(), ids.end(), [this](unsigned int a, unsigned int b){ return opcodes[a] > opcodes[b]; });
+
+    file << std::endl << "opcodes:" << std::endl;
+    for (unsigned int id : ids){
+        file << "  " << OP_NAMES[id] << " " << opcodes[id] << " " << Percent(opcodes[id], total) << "%" << std::endl;
+    }
+
+    // hottest addresses
+    std::vector<unsigned int> hot;
+    for (unsigned int address = 0; address < XO_MEMORY_SIZE; ++address){
+        if (addresses[address] > 0){
+            hot.push_back(address);
+        }
+    }
+    std::stable_sort(hot.begin(), hot.end(), [this](unsigned int a, unsigned int b){ return addresses[a] > addresses[b]; });
+    if (hot.size() > hotCount){
+        hot.resize(hotCount);
+    }
+
+    file << std::endl << "hot addresses:" << std::endl;
+    for (unsigned int address : hot){
+        file << "  " << std::hex << std::setw(3) << std::setfill('0') << address << std::dec << std::setfill(' ')
+             << " " << OP_NAMES[idOf[address]] << " " << addresses[address] << " " << Percent(addresses[address], total) << "%" << std::endl;
+    }
+
+    file << std::endl << "Dxyn: " << draws << " draws, " << drawNanoseconds / 1e6 << " ms, "
+         << (draws > 0 ? (double)drawNanoseconds / draws : 0) << " ns/draw" << std::endl;
+    // the whole instruction budget: executed, waited in Fx0A and skipped in idle loops
+    uint64_t budget = total + blocked + skipped;
+    // a wait still going on counts up to now
+    uint64_t waited = waitNanoseconds;
+    if (waiting){
+        waited += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - waitStart).count();
+    }
+    file << "Fx0A: " << waits << " waits, " << blocked << " instructions of budget waited (" << Percent(blocked, budget) << "%), "
+         << waited / 1e6 << " ms" << std::endl;
+    file << "idle loops: " << skipped << " instructions skipped (" << Percent(skipped, budget) << "%)" << std::endl;
+    return (bool)file;
+}
+
+// "sub_2a4" for a routine; the program itself is "main"
+static std::string RoutineName(uint16_t routine){
+    if (routine == START_ADDRESS){
+        return "main";
+    }
+    char name[16];
+    std::snprintf(name, sizeof(name), "sub_%03x", routine);
+    return name;
+}
+
+bool Profile::Folded(char const* filename) const{
+    std::ofstream file(filename);
+    if (!file){
+        return false;
+    }
+
+    for (unsigned int address = 0; address < XO_MEMORY_SIZE; ++address){
+        if (addresses[address] == 0){
+            continue;
+        }
+
+        // innermost routine first; bounded in case a caller chain is ever cyclic
+        std::vector<uint16_t> chain;
+        uint16_t routine = routineOf[address];
+        while (routine != NO_CALLER && chain.size() <= STACK_LEVEL){
+            chain.push_back(routine);
+            routine = caller[routine];
+        }
+
+        for (size_t i = chain.size(); i-- > 0;){
+            file << RoutineName(chain[i]) << ";";
+        }
+        char frame[16];
+        std::snprintf(frame, sizeof(frame), "%03x_%s", address, OP_NAMES[idOf[address]]);
+        file << frame << " " << addresses[address] << std::endl;
+    }
+    return (bool)file;
+}
+
+void Chip8::ExecuteProfiled(uint16_t address, Instruction const& instruction){
+    profile->Count(instruction.id, address);
+
+    switch (instruction.id){
+        case OPID_Dxyn:
+        {
+            auto startTime = std::chrono::steady_clock::now();
+            OP_Dxyn(instruction);
+            auto endTime = std::chrono::steady_clock::now();
+            profile->CountDraw(std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count());
+            break;
+        }
+        case OPID_Fx0A:
+            OP_Fx0A(instruction);
+            // without a key Fx0A stays on itself
+            if (keyWait){
+                profile->CountBlocked();
+            }
+            else{
+                profile->CountReleased();
+            }
+            break;
+        case OPID_2nnn:
+            OP_2nnn(instruction);
+            profile->Call(instruction.nnn);
+            break;
+        case OPID_00EE:
+            OP_00EE(instruction);
+            profile->Return();
+            break;
+        default:
+            ((*this).*(handlers[instruction.id]))(instruction);
+            break;
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include "chip8.hpp"
+
+/*
+ * Execution profile of a Chip8: how often every OpId and every address ran,
+ * how long Dxyn took on the host, and how long the program sat in Fx0A
+ * waiting for a key. Filled in by Chip8::Cycle() while profiling is enabled.
+ *
+ * For flame graphs, every address is attributed to the routine (2nnn target)
+ * it last ran in, and every routine to the routine that first called it, so
+ * the call chains in Folded() are rebuilt without recording a stack per
+ * instruction.
+ */
+class Profile{
+    public:
+        Profile();
+
+        // one instruction with OpId id ran at address
+        void Count(uint8_t id, uint16_t address){
+            ++opcodes[id];
+            ++addresses[address];
+            routineOf[address] = routines[depth];
+            idOf[address] = id;
+        }
+        // a Dxyn took `nanoseconds` of host time
+        void CountDraw(uint64_t nanoseconds){
+            ++draws;
+            drawNanoseconds += nanoseconds;
+        }
+        // `instructions` of budget went to an Fx0A that found no key pressed
+        void CountBlocked(uint64_t instructions = 1){
+            if (!waiting){
+                ++waits;
+                waitStart = std::chrono::steady_clock::now();
+                waiting = true;
+            }
+            blocked += instructions;
+        }
+        // an Fx0A found a key; ends the current wait, if any
+        void CountReleased(){
+            if (waiting){
+                waitNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - waitStart).count();
+                waiting = false;
+            }
+        }
+        // Run() fast-forwarded `instructions` of an idle loop
+        void CountSkipped(uint64_t instructions){ skipped += instructions; }
+        // 2nnn to target / 00EE; keep the routine stack used by Folded()
+        void Call(uint16_t target);
+        void Return(){
+            if (depth > 0){
+                --depth;
+            }
+        }
+
+        // total instructions counted
+        uint64_t Instructions() const;
+        // executions of OpId id / of the instruction at address
+        uint64_t Opcode(uint8_t id) const { return opcodes[id]; }
+        uint64_t Address(uint16_t address) const { return addresses[address]; }
+
+        // human-readable summary: opcode histogram, the `hotCount` hottest addresses, Dxyn and Fx0A time
+        bool Report(char const* filename, unsigned int hotCount = 32) const;
+        // one "routine;routine;address opcode count" line per executed address, the folded
+        // format of flamegraph.pl and speedscope
+        bool Folded(char const* filename) const;
+        // forget everything counted so far
+        void Reset();
+
+        // "00E0", "Dxyn", ... for an OpId
+        static char const* OpName(uint8_t id);
+
+    private:
+        uint64_t opcodes[OPID_COUNT];
+        // sized for XO-CHIP's memory
+        uint64_t addresses[XO_MEMORY_SIZE];
+        // OpId and routine of the last execution at every address
+        uint8_t idOf[XO_MEMORY_SIZE];
+        uint16_t routineOf[XO_MEMORY_SIZE];
+        // first routine seen calling every routine; NO_CALLER if none
+        uint16_t caller[XO_MEMORY_SIZE];
+
+        // routines[depth] is the routine running now; routines[0] is the program itself
+        uint16_t routines[STACK_LEVEL + 1];
+        unsigned int depth;
+
+        uint64_t draws;
+        uint64_t drawNanoseconds;
+        // waits: times Fx0A started waiting; blocked: instructions of budget spent waiting instead of executing
+        uint64_t waits;
+        uint64_t blocked;
+        uint64_t waitNanoseconds;
+        bool waiting;
+        // instructions of idle loops skipped instead of executed
+        uint64_t skipped;
+        std::chrono::steady_clock::time_point waitStart;
+
+        Profile(Profile const&);
+        Profile& operator=(Profile const&);
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Random bytes for Cxkk. xorshift64* with its state derived from the seed by
+ * SplitMix64: a few shifts and one multiply per byte, and the same sequence
+ * for the same seed with every compiler and standard library, so runs can be
+ * reproduced bit for bit.
+ */
+struct Random{
+    uint64_t state;
+
+    void Seed(uint64_t seed){
+        // SplitMix64 spreads nearby seeds (0, 1, 2, ...) over the whole state space
+        uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27u)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31u;
+        // xorshift must not start at 0
+        state = z != 0 ? z : 1;
+    }
+
+    uint8_t Byte(){
+        state ^= state >> 12u;
+        state ^= state << 25u;
+        state ^= state >> 27u;
+        // the top bits of the product are the best ones
+        return (state * 0x2545F4914F6CDD1DULL) >> 56u;
+    }
+};
@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "chip8.hpp"
+#include "movie.hpp"
+#include "scheduler.hpp"
+
+// emulated instructions per second unless --ips is given or the ROM has a movie; well
+// above real speed so every ROM runs long enough for its wall time to mean something
+const unsigned int DEFAULT_IPS = 60000;
+// frames every ROM runs unless --frames is given (10 minutes of emulated time)
+const uint64_t DEFAULT_FRAMES = 36000;
+// frames between display hashes unless --checkpoint is given
+const uint64_t DEFAULT_CHECKPOINT = 600;
+// timed runs per ROM unless --runs is given; the fastest counts
+const unsigned int DEFAULT_RUNS = 3;
+// a ROM is slow once it runs this many percent below its golden speed unless --tolerance is given
+const double DEFAULT_TOLERANCE = 15;
+// Cxkk seed of ROMs without a movie
+const uint64_t DEFAULT_SEED = 1;
+// golden values are kept in this file inside the ROM directory
+char const* const GOLDEN_NAME = "golden.txt";
+// scripted input for rom.ch8 is the movie rom.ch8.c8m next to it
+char const* const MOVIE_SUFFIX = ".c8m";
+
+// Runs every ROM (*.ch8) of a directory for a fixed number of frames and compares
+// the display hash at every checkpoint and the host speed against golden.txt, so
+// a change to the core can be checked for both drift and slowdowns.
+// Exits with failure if any ROM drifted, got slower or is missing from the golden file.
+
+// What one ROM did
+struct RegressResult{
+    // (frame, Chip8::VideoHash) at every checkpoint and at the end
+    std::vector<std::pair<uint64_t, uint64_t>> hashes;
+    uint64_t instructions;
+    unsigned int instructionsPerSecond;
+    // wall time of the fastest run
+    double seconds;
+};
+
+// Golden values of one ROM
+struct Golden{
+    std::map<uint64_t, uint64_t> hashes;
+    // host instructions per second; 0 if not recorded
+    double speed;
+};
+
+static void usage(char const* name){
+    std::cerr << "Usage: " << name << " [--frames N] [--checkpoint N] [--ips N] [--engine table|threaded|jit] [--variant chip8|schip|xochip] [--runs N] [--tolerance PERCENT] [--update] <DIR>" << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+static bool EndsWith(std::string const& text, std::string const& suffix){
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// file names of every ROM in directory, sorted
+static bool ListROMs(std::string const& directory, std::vector<std::string>& roms){
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr){
+        return false;
+    }
+    while (dirent* entry = readdir(dir)){
+        std::string name = entry->d_name;
+        if (EndsWith(name, ".ch8")){
+            roms.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(roms.begin(), roms.end());
+    return true;
+}
+
+// Lines are "<rom> <frame> <hash in hex>" or "<rom> speed <instructions per second>"; # starts a comment.
+// A missing file is an empty golden set.
+static bool ReadGolden(std::string const& filename, std::map<std::string, Golden>& golden){
+    std::ifstream file(filename);
+    if (!file){
+        return true;
+    }
+
+    std::string line;
+    while (std::getline(file, line)){
+        if (line.empty() || line[0] == '#'){
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string rom;
+        std::string key;
+        if (!(fields >> rom >> key)){
+            return false;
+        }
+        Golden& entry = golden[rom];
+        if (key == "speed"){
+            if (!(fields >> entry.speed)){
+                return false;
+            }
+        }
+        else{
+            // the key is the frame, and nothing but its digits
+            std::istringstream frameField(key);
+            uint64_t frame;
+            uint64_t hash;
+            if (!(frameField >> frame) || !frameField.eof() || !(fields >> std::hex >> hash)){
+                return false;
+            }
+            entry.hashes[frame] = hash;
+        }
+    }
+    return true;
+}
+
+static bool WriteGolden(std::string const& filename, std::vector<std::string> const& roms, std::vector<RegressResult> const& results){
+    std::ofstream file(filename);
+    if (!file){
+        return false;
+    }
+
+    file << "# rom frame video-hash / rom speed host-instructions-per-second" << std::endl;
+    for (size_t i = 0; i < roms.size(); ++i){
+        // ROMs that failed to run get no golden values
+        if (results[i].hashes.empty()){
+            continue;
+        }
+        for (auto const& checkpoint : results[i].hashes){
+            file << roms[i] << " " << std::dec << checkpoint.first << " " << std::hex << checkpoint.second << std::endl;
+        }
+        file << roms[i] << " speed " << std::dec << (uint64_t)(results[i].instructions / results[i].seconds) << std::endl;
+    }
+    return (bool)file;
+}
+
+// Runs one ROM `runs` times. False if it cannot be loaded or two runs disagree,
+// which would make its golden hashes meaningless.
+static bool Run(std::string const& romName, Engine engine, Variant variant, unsigned int ips, uint64_t frames, uint64_t checkpoint,
+                unsigned int runs, RegressResult& result){
+    Movie movie;
+    bool scripted = movie.Load((romName + MOVIE_SUFFIX).c_str());
+    if (scripted){
+        ips = movie.InstructionsPerSecond();
+    }
+
+    for (unsigned int run = 0; run < runs; ++run){
+        Chip8 chip8(DEFAULT_SEED);
+        chip8.SetVariant(variant);
+        if (!chip8.LoadROM(romName.c_str())){
+            return false;
+        }
+        chip8.SetEngine(engine);
+        Scheduler scheduler(ips);
+        // the movie's first keyframe brings the ROM, seed and variant it was recorded with
+        if (scripted && !movie.Seek(chip8, scheduler, 0)){
+            return false;
+        }
+
+        std::vector<std::pair<uint64_t, uint64_t>> hashes;
+        uint64_t instructions = 0;
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        for (uint64_t frame = 0; frame < frames; ++frame){
+            // past the end of the movie the keypad stays as it was left
+            if (scripted && frame < movie.Frames()){
+                movie.Apply(chip8, frame);
+            }
+            instructions += scheduler.RunFrame(chip8);
+            if ((frame + 1) % checkpoint == 0 || frame + 1 == frames){
+                hashes.push_back(std::make_pair(frame + 1, chip8.VideoHash()));
+            }
+        }
+        auto endTime = std::chrono::high_resolution_clock::now();
+
+        double seconds = std::chrono::duration<double>(endTime - startTime).count();
+        if (run == 0){
+            result.hashes = hashes;
+            result.instructions = instructions;
+            result.instructionsPerSecond = ips;
+            result.seconds = seconds;
+        }
+        else if (hashes != result.hashes){
+            return false;
+        }
+        result.seconds = std::min(result.seconds, seconds);
+    }
+    return true;
+}
+
+int main(int argc, char** argv){
+    uint64_t frames = DEFAULT_FRAMES;
+    uint64_t checkpoint = DEFAULT_CHECKPOINT;
+    unsigned int ips = DEFAULT_IPS;
+    Engine engine = ENGINE_TABLE;
+    Variant variant = VARIANT_CHIP8;
+    unsigned int runs = DEFAULT_RUNS;
+    double tolerance = DEFAULT_TOLERANCE;
+    // write the results as the new golden values instead of comparing
+    bool update = false;
+    char const* directory = nullptr;
+
+    for (int i = 1; i < argc; ++i){
+        if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc){
+            frames = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc){
+            checkpoint = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--ips") == 0 && i + 1 < argc){
+            ips = std::stoul(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc){
+            if (!Chip8::EngineFromName(argv[++i], engine)){
+                usage(argv[0]);
+            }
+        }
+        else if (std::strcmp(argv[i], "--variant") == 0 && i + 1 < argc){
+            if (!Chip8::VariantFromName(argv[++i], variant)){
+                usage(argv[0]);
+            }
+        }
+        else if (std::strcmp(argv[i], "--runs") == 0 && i + 1 < argc){
+            runs = std::stoul(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc){
+            tolerance = std::stod(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--update") == 0){
+            update = true;
+        }
+        else if (argv[i][0] == '-' || directory != nullptr){
+            usage(argv[0]);
+        }
+        else{
+            directory = argv[i];
+        }
+    }
+
+    if (directory == nullptr || frames == 0 || checkpoint == 0 || runs == 0 || ips < TIMER_HZ){
+        usage(argv[0]);
+    }
+
+    std::vector<std::string> roms;
+    if (!ListROMs(directory, roms)){
+        std::cerr << "Could not open directory " << directory << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    std::string goldenName = std::string(directory) + "/" + GOLDEN_NAME;
+    std::map<std::string, Golden> golden;
+    if (!update && !ReadGolden(goldenName, golden)){
+        std::cerr << "Could not parse " << goldenName << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<RegressResult> results(roms.size());
+    unsigned int failures = 0;
+
+    for (size_t i = 0; i < roms.size(); ++i){
+        RegressResult& result = results[i];
+        if (!Run(std::string(directory) + "/" + roms[i], engine, variant, ips, frames, checkpoint, runs, result)){
+            std::cout << roms[i] << " error: could not load or not deterministic" << std::endl;
+            ++failures;
+            continue;
+        }
+
+        double speed = result.seconds > 0 ? result.instructions / result.seconds : 0;
+        std::string status = "ok";
+        if (!update){
+            auto entry = golden.find(roms[i]);
+            if (entry == golden.end()){
+                status = "new";
+            }
+            else{
+                // first checkpoint whose hash differs or is missing
+                for (auto const& checkpointHash : result.hashes){
+                    auto expected = entry->second.hashes.find(checkpointHash.first);
+                    if (expected == entry->second.hashes.end() || expected->second != checkpointHash.second){
+                        status = "drift@" + std::to_string(checkpointHash.first);
+                        break;
+                    }
+                }
+                if (status == "ok" && speed < entry->second.speed * (1 - tolerance / 100)){
+                    status = "slow";
+                }
+            }
+            if (status != "ok"){
+                ++failures;
+            }
+        }
+
+        std::cout << roms[i] << " " << std::hex << result.hashes.back().second << std::dec << " " << result.instructions
+                  << " " << result.instructionsPerSecond << " " << result.seconds << " " << (uint64_t)speed;
+        if (!update){
+            auto entry = golden.find(roms[i]);
+            if (entry != golden.end() && entry->second.speed > 0){
+                std::cout << " " << (int)(100 * (speed / entry->second.speed - 1)) << "%";
+            }
+        }
+        std::cout << " " << status << std::endl;
+    }
+
+    if (update){
+        if (!WriteGolden(goldenName, roms, results)){
+            std::cerr << "Could not write " << goldenName << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        std::cerr << "wrote " << goldenName << std::endl;
+    }
+    std::cerr << roms.size() << " ROMs, " << failures << " failed" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
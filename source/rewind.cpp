@@ -0,0 +1,235 @@
+#include "rewind.hpp"
+#include "chip8.hpp"
+#include <cstring>
+
+// A delta is a sequence of chunks: a uint16_t count of unchanged bytes to skip, a
+// uint16_t count of changed bytes, then the changed bytes XORed with the keyframe.
+// Longer unchanged runs (in 64 KB of XO-CHIP memory) take several chunks with no changed bytes.
+const size_t CHUNK_HEADER = 2 * sizeof(uint16_t);
+// unchanged bytes needed to end a run of changed ones; shorter gaps are cheaper to copy
+const size_t MIN_ZERO_RUN = CHUNK_HEADER;
+// largest count in a chunk header, and so the largest delta worth storing (Record::size)
+const size_t MAX_CHUNK_COUNT = 0xFFFF;
+
+Rewind::Rewind(size_t arenaBytes, unsigned int maxFrames, unsigned int keyframeInterval)
+    : arena(arenaBytes > 2 * MAX_STATE_SIZE ? arenaBytes : 2 * MAX_STATE_SIZE),
+      records(maxFrames > 2 ? maxFrames : 2),
+      keyframeInterval(keyframeInterval == 0 ? 1 : keyframeInterval > 0xFFFF ? 0xFFFF : keyframeInterval),
+      encoded(MAX_CHUNK_COUNT)
+    {
+}
+
+void Rewind::Clear(){
+    count = 0;
+    writeOffset = 0;
+    needKeyframe = true;
+}
+
+size_t Rewind::BytesUsed() const{
+    if (count == 0){
+        return 0;
+    }
+    size_t oldest = records[first % records.size()].offset;
+    return writeOffset > oldest ? writeOffset - oldest : arena.size() - oldest + writeOffset;
+}
+
+void Rewind::Push(Chip8 const& chip8){
+    Chip8State& state = scratch.State();
+    chip8.SaveState(state);
+    // deltas only work between states of one size
+    if (state.Size() != stateSize){
+        Clear();
+        stateSize = state.Size();
+    }
+
+    uint64_t frame = first + count;
+    if (count == records.size()){
+        DropOldest();
+    }
+
+    bool isKeyframe = needKeyframe || frame - keyframeFrame >= keyframeInterval;
+    size_t size = isKeyframe ? 0 : Encode(state, keyframe.State());
+    size_t offset = 0;
+    if (size > 0){
+        offset = Allocate(size);
+        // making room may have dropped the keyframe this delta needs
+        if (needKeyframe){
+            writeOffset = offset;
+            size = 0;
+        }
+    }
+    if (size == 0){
+        isKeyframe = true;
+        size = stateSize;
+        offset = Allocate(size);
+    }
+
+    if (count == 0){
+        first = frame;
+    }
+    Record& record = RecordOf(frame);
+    record.offset = offset;
+    record.size = isKeyframe ? 0 : size;
+    if (isKeyframe){
+        memcpy(&arena[offset], &state, size);
+        memcpy(&keyframe.State(), &state, size);
+        keyframeFrame = frame;
+        needKeyframe = false;
+    }
+    else{
+        memcpy(&arena[offset], encoded.data(), size);
+    }
+    record.keyframeDistance = frame - keyframeFrame;
+    ++count;
+}
+
+bool Rewind::StepBack(Chip8& chip8){
+    if (count < 2){
+        return false;
+    }
+
+    // forget the newest frame; its bytes are free again
+    --count;
+    uint64_t frame = first + count - 1;
+    Record const& record = RecordOf(frame);
+    writeOffset = record.offset + SizeOf(record);
+    if (keyframeFrame > frame){
+        needKeyframe = true;
+    }
+
+    Chip8State& state = scratch.State();
+    Record const& base = RecordOf(frame - record.keyframeDistance);
+    if (record.keyframeDistance == 0){
+        memcpy(&state, &arena[record.offset], stateSize);
+    }
+    else{
+        Decode(&arena[record.offset], record.size, &arena[base.offset], state);
+    }
+
+    memcpy(state.keypad, chip8.keypad, sizeof(state.keypad));
+    chip8.LoadState(state);
+    return true;
+}
+
+size_t Rewind::Allocate(size_t size){
+    if (writeOffset + size > arena.size()){
+        // the end of the ring is too short: drop the frames still stored there and start over at 0
+        while (count > 0 && RecordOf(first).offset >= writeOffset){
+            DropOldest();
+        }
+        writeOffset = 0;
+    }
+
+    while (count > 0){
+        Record const& oldest = RecordOf(first);
+        if (oldest.offset >= writeOffset + size || writeOffset >= oldest.offset + SizeOf(oldest)){
+            break;
+        }
+        DropOldest();
+    }
+
+    size_t offset = writeOffset;
+    writeOffset += size;
+    return offset;
+}
+
+void Rewind::DropOldest(){
+    bool wasKeyframe = RecordOf(first).keyframeDistance == 0;
+    ++first;
+    --count;
+
+    // deltas against a dropped keyframe cannot be restored any more
+    if (wasKeyframe){
+        while (count > 0 && RecordOf(first).keyframeDistance != 0){
+            ++first;
+            --count;
+        }
+    }
+    if (count == 0 || keyframeFrame < first){
+        needKeyframe = true;
+    }
+}
+
+size_t Rewind::Encode(Chip8State const& state, Chip8State const& base){
+    uint8_t const* current = reinterpret_cast<uint8_t const*>(&state);
+    uint8_t const* previous = reinterpret_cast<uint8_t const*>(&base);
+    uint8_t* out = encoded.data();
+    // a delta must come out smaller than the keyframe it replaces
+    size_t limit = stateSize < encoded.size() ? stateSize : encoded.size();
+    size_t used = 0;
+    size_t i = 0;
+
+    while (i < stateSize){
+        size_t zeroStart = i;
+        // most of the state (memory above all) is unchanged: skip it a word at a time
+        while (i + sizeof(uint64_t) <= stateSize && memcmp(current + i, previous + i, sizeof(uint64_t)) == 0){
+            i += sizeof(uint64_t);
+        }
+        while (i < stateSize && current[i] == previous[i]){
+            ++i;
+        }
+        if (i == stateSize){
+            break;
+        }
+        // a skip longer than a header can count goes into chunks of its own
+        while (i - zeroStart > MAX_CHUNK_COUNT){
+            if (used + CHUNK_HEADER >= limit){
+                return 0;
+            }
+            uint16_t header[2] = { (uint16_t)MAX_CHUNK_COUNT, 0 };
+            memcpy(out + used, header, CHUNK_HEADER);
+            used += CHUNK_HEADER;
+            zeroStart += MAX_CHUNK_COUNT;
+        }
+
+        // changed bytes run until MIN_ZERO_RUN unchanged ones in a row (or the end)
+        size_t changeStart = i;
+        size_t zeros = 0;
+        while (i < stateSize && zeros < MIN_ZERO_RUN){
+            zeros = current[i] == previous[i] ? zeros + 1 : 0;
+            ++i;
+        }
+        size_t changeEnd = i - zeros;
+        i = changeEnd;
+
+        size_t length = changeEnd - changeStart;
+        if (used + CHUNK_HEADER + length >= limit){
+            // not worth it; store a keyframe instead
+            return 0;
+        }
+        uint16_t header[2] = { (uint16_t)(changeStart - zeroStart), (uint16_t)length };
+        memcpy(out + used, header, CHUNK_HEADER);
+        used += CHUNK_HEADER;
+        for (size_t j = 0; j < length; ++j){
+            out[used + j] = current[changeStart + j] ^ previous[changeStart + j];
+        }
+        used += length;
+    }
+
+    // identical to the keyframe: one empty chunk, so the record is never 0 bytes
+    if (used == 0){
+        uint16_t header[2] = { 0, 0 };
+        memcpy(out, header, CHUNK_HEADER);
+        used = CHUNK_HEADER;
+    }
+    return used;
+}
+
+void Rewind::Decode(uint8_t const* data, size_t size, uint8_t const* base, Chip8State& state) const{
+    memcpy(&state, base, stateSize);
+    uint8_t* out = reinterpret_cast<uint8_t*>(&state);
+
+    size_t position = 0;
+    size_t used = 0;
+    while (used + CHUNK_HEADER <= size){
+        uint16_t header[2];
+        memcpy(header, data + used, CHUNK_HEADER);
+        used += CHUNK_HEADER;
+        position += header[0];
+        for (size_t j = 0; j < header[1]; ++j){
+            out[position + j] ^= data[used + j];
+        }
+        position += header[1];
+        used += header[1];
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "savestate.hpp"
+
+class Chip8;
+
+/*
+ * History of whole-machine states for stepping backwards. Every `keyframeInterval`
+ * frames a full state is stored; the frames in between are stored as the
+ * XOR of their state against that keyframe with the runs of zero bytes squeezed
+ * out, which is a few dozen bytes for a typical frame. Everything lives in one
+ * preallocated byte ring: when it is full the oldest frames are dropped, so
+ * Push and StepBack never allocate.
+ */
+class Rewind{
+    public:
+        // arenaBytes of storage, at most maxFrames frames; keyframeInterval is capped at 65535
+        Rewind(size_t arenaBytes, unsigned int maxFrames, unsigned int keyframeInterval);
+
+        // record the state of chip8 as the newest frame. A state of another size than the
+        // ones stored (another variant) starts the history over.
+        void Push(Chip8 const& chip8);
+        // drop the newest frame and restore chip8 to the one before it; false if there is none.
+        // The keypad is left alone since it follows the host keyboard, not the history.
+        bool StepBack(Chip8& chip8);
+        // forget every frame
+        void Clear();
+
+        // frames that can be stepped back to, plus the current one
+        unsigned int Frames() const { return count; }
+        // bytes of the ring in use, including space lost at the end when wrapping
+        size_t BytesUsed() const;
+
+    private:
+        // 8 bytes, so an hour of frames at 60 Hz costs under 2 MB of records
+        struct Record{
+            uint32_t offset;
+            // bytes of a delta; a keyframe is always stateSize, which may not fit (see SizeOf)
+            uint16_t size;
+            // frames back to the keyframe this delta is against; 0 for keyframes
+            uint16_t keyframeDistance;
+        };
+
+        std::vector<uint8_t> arena;
+        // records[frame % records.size()] for the last `count` frames
+        std::vector<Record> records;
+        unsigned int keyframeInterval;
+
+        // frame number of the oldest record; the newest is first + count - 1
+        uint64_t first{};
+        unsigned int count{};
+        // next byte of arena to write to
+        size_t writeOffset{};
+        // frame number of the newest keyframe
+        uint64_t keyframeFrame{};
+        // true if the newest keyframe was dropped or stepped over, so the next push needs a new one
+        bool needKeyframe{true};
+
+        // bytes of every state in the ring (see Chip8::StateSize); 0 while it is empty
+        size_t stateSize{};
+        // the newest keyframe, kept decoded for XORing against
+        StateBuffer keyframe;
+        // preallocated scratch space for the state being pushed or restored
+        StateBuffer scratch;
+        std::vector<uint8_t> encoded;
+
+        Record& RecordOf(uint64_t frame){ return records[frame % records.size()]; }
+        size_t SizeOf(Record const& record) const { return record.keyframeDistance == 0 ? stateSize : record.size; }
+        // reserve size bytes for the next record, dropping old frames that are in the way
+        size_t Allocate(size_t size);
+        // drop the oldest frame, and the deltas after it if it was a keyframe
+        void DropOldest();
+        // XOR state against base and run-length encode the zero bytes into encoded;
+        // returns the encoded size, or 0 if it would not be smaller than a keyframe
+        size_t Encode(Chip8State const& state, Chip8State const& base);
+        // state = the keyframe stored at base XOR the decoded delta
+        void Decode(uint8_t const* data, size_t size, uint8_t const* base, Chip8State& state) const;
+};
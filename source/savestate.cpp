@@ -0,0 +1,163 @@
+#include "savestate.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+size_t Chip8::StateSize() const{
+    return sizeof(Chip8State) + MemorySize();
+}
+
+void Chip8::SaveState(Chip8State& state) const{
+    state.magic = STATE_MAGIC;
+    state.version = STATE_VERSION;
+    memcpy(state.video, video, sizeof(video));
+    memcpy(state.stack, stack, sizeof(stack));
+    memcpy(state.registers, registers, sizeof(registers));
+    memcpy(state.keypad, keypad, sizeof(keypad));
+    memcpy(state.flags, flags, sizeof(flags));
+    memcpy(state.audioPattern, audioPattern, sizeof(audioPattern));
+    state.index = index;
+    state.pc = pc;
+    state.sp = sp;
+    state.delayTimer = delayTimer;
+    state.soundTimer = soundTimer;
+    state.variant = variant;
+    state.hires = hires;
+    state.planes = planes;
+    state.pitch = pitch;
+    state.reserved = 0;
+    state.memorySize = MemorySize();
+    state.random = random.state;
+    memcpy(state.Memory(), memory, MemorySize());
+}
+
+bool Chip8::LoadState(Chip8State const& state){
+    if (state.magic != STATE_MAGIC || state.version != STATE_VERSION || state.variant > VARIANT_XOCHIP
+        || state.memorySize != (state.variant == VARIANT_XOCHIP ? XO_MEMORY_SIZE : MEMORY_SIZE)){
+        return false;
+    }
+    // only Fx01 changes planes, and xorshift stays at 0 forever once there
+    bool planesValid = state.variant == VARIANT_XOCHIP ? state.planes < (1u << PLANE_COUNT) : state.planes == 1;
+    if (!planesValid || state.random == 0){
+        return false;
+    }
+
+    // another instruction set decodes every byte differently
+    bool variantChanged = state.variant != variant;
+    if (variantChanged){
+        variant = static_cast<Variant>(state.variant);
+        ApplyVariant();
+    }
+
+    // Only re-decode the parts of memory that differ. Restoring a snapshot of the
+    // same program usually changes a few data bytes, not the code.
+    uint8_t const* savedMemory = state.Memory();
+    for (unsigned int address = 0; address < MemorySize(); address += sizeof(uint64_t)){
+        uint64_t current;
+        uint64_t saved;
+        memcpy(&current, &memory[address], sizeof(current));
+        memcpy(&saved, &savedMemory[address], sizeof(saved));
+        if (current != saved){
+            memcpy(&memory[address], &saved, sizeof(saved));
+            if (!variantChanged){
+                Predecode(address, sizeof(saved));
+            }
+        }
+    }
+    if (variantChanged){
+        Predecode(0, MemorySize());
+    }
+
+    memcpy(video, state.video, sizeof(video));
+    memcpy(stack, state.stack, sizeof(stack));
+    memcpy(registers, state.registers, sizeof(registers));
+    memcpy(keypad, state.keypad, sizeof(keypad));
+    memcpy(flags, state.flags, sizeof(flags));
+    memcpy(audioPattern, state.audioPattern, sizeof(audioPattern));
+    index = state.index;
+    pc = state.pc;
+    sp = state.sp;
+    delayTimer = state.delayTimer;
+    soundTimer = state.soundTimer;
+    hires = state.hires != 0;
+    planes = state.planes;
+    pitch = state.pitch;
+    random.state = state.random;
+
+    // the whole display may have changed
+    dirtyRows = ~0ULL;
+    return true;
+}
+
+SnapshotFile::SnapshotFile(){
+}
+
+SnapshotFile::~SnapshotFile(){
+    Close();
+}
+
+bool SnapshotFile::Open(char const* filename){
+    Close();
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0){
+        return false;
+    }
+    // every state has the size of the first
+    struct stat info;
+    Chip8State first;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Chip8State)
+        || pread(fd, &first, sizeof(first), 0) != static_cast<ssize_t>(sizeof(first))
+        || first.memorySize > XO_MEMORY_SIZE || info.st_size % first.Size() != 0){
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps the file alive
+    close(fd);
+    if (mapped == MAP_FAILED){
+        return false;
+    }
+    states = static_cast<uint8_t*>(mapped);
+    stateSize = first.Size();
+    count = info.st_size / stateSize;
+    return true;
+}
+
+bool SnapshotFile::Create(char const* filename, size_t count, size_t stateSize){
+    Close();
+
+    if (count == 0 || stateSize < sizeof(Chip8State)){
+        return false;
+    }
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){
+        return false;
+    }
+    size_t size = count * stateSize;
+    if (ftruncate(fd, size) != 0){
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED){
+        return false;
+    }
+    states = static_cast<uint8_t*>(mapped);
+    this->count = count;
+    this->stateSize = stateSize;
+    return true;
+}
+
+void SnapshotFile::Close(){
+    if (states != nullptr){
+        munmap(states, count * stateSize);
+        states = nullptr;
+        count = 0;
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "chip8.hpp"
+
+// first four bytes of every state: "C8ST" read as a little-endian word
+const uint32_t STATE_MAGIC = 0x54533843;
+// bump whenever the layout or meaning of Chip8State changes
+// (2: random holds the Random state instead of std::default_random_engine;
+//  3: SCHIP/XO-CHIP display planes, 64 KB of memory and the variant;
+//  4: memory follows the struct and is only as large as the variant's)
+const uint32_t STATE_VERSION = 4;
+
+/*
+ * Everything needed to resume a Chip8: a fixed-layout block with no pointers
+ * or padding, directly followed by the machine's memory, so a state is saved
+ * or restored with memcpy and a file of them can be mapped and used in place.
+ * Only XO-CHIP states carry 64 KB of memory; the others carry 4 KB, so Size()
+ * and not sizeof gives the bytes of a state. Multi-byte fields are in host
+ * byte order. The decoded-instruction cache, JIT and trace are not part of the
+ * state; they are rebuilt or left alone on load.
+ */
+struct Chip8State{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t video[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS];
+    uint16_t stack[STACK_LEVEL];
+    uint8_t registers[REGISTER_COUNT];
+    uint8_t keypad[KEY_COUNT];
+    uint8_t flags[REGISTER_COUNT];
+    uint8_t audioPattern[AUDIO_PATTERN_SIZE];
+    uint16_t index;
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    // Variant
+    uint8_t variant;
+    uint8_t hires;
+    uint8_t planes;
+    uint8_t pitch;
+    uint8_t reserved;
+    // bytes of memory after the struct: MEMORY_SIZE, or XO_MEMORY_SIZE for XO-CHIP
+    uint32_t memorySize;
+    // Random::state
+    uint64_t random;
+
+    uint8_t* Memory(){ return reinterpret_cast<uint8_t*>(this + 1); }
+    uint8_t const* Memory() const { return reinterpret_cast<uint8_t const*>(this + 1); }
+    // the struct and its memory
+    size_t Size() const { return sizeof(Chip8State) + memorySize; }
+};
+
+// catches accidental layout changes; update STATE_VERSION together with this
+static_assert(sizeof(Chip8State) == 2176, "Chip8State layout changed");
+
+// bytes of the largest state, an XO-CHIP one
+const size_t MAX_STATE_SIZE = sizeof(Chip8State) + XO_MEMORY_SIZE;
+
+/*
+ * Heap space for one state, aligned for Chip8State. Sized for any variant by
+ * default, or for one known size (see Chip8::StateSize) to keep many of them.
+ */
+class StateBuffer{
+    public:
+        explicit StateBuffer(size_t size = MAX_STATE_SIZE) : words((size + sizeof(uint64_t) - 1) / sizeof(uint64_t)) {}
+
+        Chip8State& State(){ return *reinterpret_cast<Chip8State*>(words.data()); }
+        Chip8State const& State() const { return *reinterpret_cast<Chip8State const*>(words.data()); }
+
+    private:
+        std::vector<uint64_t> words;
+};
+
+/*
+ * A file of `count` consecutive Chip8States of one size mapped into memory. States are read
+ * and written in place; the kernel pages them in and out, so opening a file of
+ * millions of snapshots costs nothing until they are touched.
+ */
+class SnapshotFile{
+    public:
+        SnapshotFile();
+        ~SnapshotFile();
+
+        // map an existing file read-only; false if it cannot be mapped or is not a whole number
+        // of states of the size the first one has
+        bool Open(char const* filename);
+        // create (or truncate) a file with room for count states of stateSize bytes and map it read-write
+        bool Create(char const* filename, size_t count, size_t stateSize);
+        // unmap; changes made through State() are written back by the kernel
+        void Close();
+
+        size_t Count() const { return count; }
+        Chip8State const* State(size_t i) const { return reinterpret_cast<Chip8State const*>(states + i * stateSize); }
+        // only valid for files opened with Create
+        Chip8State* State(size_t i) { return reinterpret_cast<Chip8State*>(states + i * stateSize); }
+
+    private:
+        uint8_t* states{};
+        size_t count{};
+        size_t stateSize{};
+
+        SnapshotFile(SnapshotFile const&);
+        SnapshotFile& operator=(SnapshotFile const&);
+};
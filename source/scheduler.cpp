@@ -0,0 +1,60 @@
+#include "scheduler.hpp"
+#include "chip8.hpp"
+#include "sound.hpp"
+
+Scheduler::Scheduler(unsigned int instructionsPerSecond)
+    : instructionsPerSecond(instructionsPerSecond),
+      baseBudget(instructionsPerSecond / TIMER_HZ),
+      extraPerSecond(instructionsPerSecond % TIMER_HZ)
+    {
+}
+
+unsigned int Scheduler::RunFrame(Chip8& chip8){
+    unsigned int budget = NextFrame();
+
+    chip8.Run(budget);
+
+    // one 60 Hz tick per frame of emulated time
+    chip8.TickTimers();
+
+    return budget;
+}
+
+unsigned int Scheduler::RunFrame(Chip8& chip8, Sound& sound){
+    unsigned int budget = NextFrame();
+
+    // the budget spread evenly over the parts; Run gives the same result however it is split
+    unsigned int executed = 0;
+    for (unsigned int part = 1; part <= SOUND_SUBFRAMES; ++part){
+        unsigned int end = static_cast<unsigned int>(static_cast<uint64_t>(budget) * part / SOUND_SUBFRAMES);
+        if (end > executed){
+            chip8.Run(end - executed);
+            executed = end;
+        }
+        if (part == SOUND_SUBFRAMES){
+            chip8.TickTimers();
+        }
+        sound.Advance(chip8);
+    }
+
+    return budget;
+}
+
+void Scheduler::SeekFrame(uint64_t frame){
+    frames = frame;
+    // after n frames the accumulator holds n * extraPerSecond modulo TIMER_HZ
+    extraAccumulator = (frame % TIMER_HZ) * extraPerSecond % TIMER_HZ;
+}
+
+unsigned int Scheduler::NextFrame(){
+    unsigned int budget = baseBudget;
+
+    extraAccumulator += extraPerSecond;
+    if (extraAccumulator >= TIMER_HZ){
+        extraAccumulator -= TIMER_HZ;
+        ++budget;
+    }
+    ++frames;
+
+    return budget;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+
+class Chip8;
+class Sound;
+
+// delay and sound timers count down at this rate, independent of CPU speed
+const unsigned int TIMER_HZ = 60;
+
+/*
+ * Splits emulated time into 1/60 s frames. Each frame runs that frame's share
+ * of the instruction budget and then ticks the timers once, so timer speed no
+ * longer depends on how fast instructions execute. When the rate does not
+ * divide evenly by 60 the leftover instructions are spread over the frames, so
+ * exactly `instructionsPerSecond` run per 60 frames.
+ */
+class Scheduler{
+    public:
+        explicit Scheduler(unsigned int instructionsPerSecond);
+
+        // run one frame of emulated time; returns number of instructions executed
+        unsigned int RunFrame(Chip8& chip8);
+        // same, in SOUND_SUBFRAMES parts with the sound reported after each, so sound.hpp can
+        // place a sound timer change within the frame. The machine ends up exactly as above.
+        unsigned int RunFrame(Chip8& chip8, Sound& sound);
+        // count one frame of emulated time and return its budget without running anything;
+        // for callers that drive something other than one Chip8 (see Lockstep)
+        unsigned int NextFrame();
+        // continue as if `frame` frames had already run, e.g. after restoring a state saved then
+        void SeekFrame(uint64_t frame);
+
+        unsigned int InstructionsPerSecond() const { return instructionsPerSecond; }
+        // frames run so far; frames / TIMER_HZ is emulated seconds
+        uint64_t Frames() const { return frames; }
+
+    private:
+        unsigned int instructionsPerSecond;
+        // instructions every frame gets
+        unsigned int baseBudget;
+        // instructions per second left over after baseBudget * TIMER_HZ
+        unsigned int extraPerSecond;
+        // accumulates extraPerSecond; one extra instruction each time it passes TIMER_HZ
+        unsigned int extraAccumulator{};
+        uint64_t frames{};
+};
@@ -0,0 +1,91 @@
+#include "sound.hpp"
+#include <cmath>
+#include <cstring>
+
+Sound::Sound(){
+}
+
+void Sound::Advance(Chip8 const& chip8, unsigned int subframes){
+    time += subframes;
+
+    SoundEdge state{};
+    state.time = time;
+    state.on = chip8.SoundTimer() > 0;
+    state.pitch = chip8.Pitch();
+    std::memcpy(state.pattern, chip8.AudioPattern(), sizeof(state.pattern));
+    // a pattern that was never loaded is all 0 and would be silent, so it keeps the buzzer
+    if (chip8.GetVariant() == VARIANT_XOCHIP){
+        for (unsigned int i = 0; i < AUDIO_PATTERN_SIZE; ++i){
+            state.patterned = state.patterned || state.pattern[i] != 0;
+        }
+    }
+
+    // what plays while the sound is off does not matter; turning it on carries the new pattern
+    bool changed = state.on != latest.on
+        || (state.on && (state.patterned != latest.patterned || state.pitch != latest.pitch
+                         || std::memcmp(state.pattern, latest.pattern, sizeof(state.pattern)) != 0));
+    // an edge that did not fit is sent as soon as there is room, as whatever the sound is by then
+    if (changed || unsent){
+        latest = state;
+        unsent = !queue.Push(latest);
+        overflows += unsent ? 1 : 0;
+    }
+    now.store(time, std::memory_order_release);
+}
+
+void Sound::SetSampleRate(unsigned int rate){
+    this->rate = rate;
+    Apply(current);
+}
+
+void Sound::Apply(SoundEdge const& edge){
+    current = edge;
+    // phase wraps at 2^32 once per buzzer period, or once per pass over the whole pattern
+    double frequency = BUZZER_HZ;
+    if (current.patterned){
+        frequency = PATTERN_BASE_RATE * std::pow(2.0, (current.pitch - 64) / 48.0) / (AUDIO_PATTERN_SIZE * 8);
+    }
+    phaseStep = static_cast<uint32_t>(frequency / rate * 4294967296.0);
+}
+
+void Sound::Mix(int16_t* samples, unsigned int count){
+    // play SOUND_LATENCY_FRAMES behind what has been emulated, and never past it
+    uint64_t newest = now.load(std::memory_order_acquire) * rate;
+    uint64_t latency = static_cast<uint64_t>(SOUND_LATENCY_FRAMES) * SOUND_SUBFRAMES * rate;
+    uint64_t drift = static_cast<uint64_t>(SOUND_DRIFT_FRAMES) * SOUND_SUBFRAMES * rate;
+    if (!playing && newest < latency){
+        // not enough emulated yet to start that far behind it
+        std::memset(samples, 0, count * sizeof(samples[0]));
+        return;
+    }
+    uint64_t target = newest - latency;
+    if (!playing || position + drift < target || position > target + drift){
+        resyncs += playing ? 1 : 0;
+        position = target;
+        playing = true;
+    }
+
+    for (unsigned int i = 0; i < count; ++i){
+        // every edge due by this sample, so one jumped over still leaves the sound right
+        SoundEdge const* edge = queue.Peek();
+        while (edge != nullptr && edge->time * rate <= position){
+            Apply(*edge);
+            queue.Pop();
+            ++edges;
+            edge = queue.Peek();
+        }
+
+        bool high = phase < 0x80000000u;
+        if (current.patterned){
+            // top 7 bits of the phase pick one of the 128 samples, leftmost bit first
+            unsigned int bit = phase >> 25;
+            high = (current.pattern[bit >> 3] & (0x80u >> (bit & 7))) != 0;
+        }
+        samples[i] = current.on ? (high ? SOUND_AMPLITUDE : -SOUND_AMPLITUDE) : 0;
+        phase += phaseStep;
+
+        if (position + SOUND_TICKS_PER_SECOND <= newest){
+            position += SOUND_TICKS_PER_SECOND;
+        }
+    }
+}
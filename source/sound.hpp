@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "chip8.hpp"
+#include "scheduler.hpp"
+#include "spscqueue.hpp"
+
+// parts a frame is split into for timing sound; an edge is placed to within 1 / (TIMER_HZ * SOUND_SUBFRAMES) s
+const unsigned int SOUND_SUBFRAMES = 16;
+const unsigned int SOUND_TICKS_PER_SECOND = TIMER_HZ * SOUND_SUBFRAMES;
+// edges in flight between the emulation and audio threads
+const size_t SOUND_QUEUE_SIZE = 1024;
+// output is played this far behind the newest emulated time, so a whole frame of edges has always arrived
+const unsigned int SOUND_LATENCY_FRAMES = 3;
+// once playback drifts further than this from that target, it jumps back to it
+const unsigned int SOUND_DRIFT_FRAMES = 2;
+// tone of the plain CHIP-8 buzzer
+const unsigned int BUZZER_HZ = 440;
+// XO-CHIP pattern samples per second at pitch 64; every 48 steps of pitch double it
+const double PATTERN_BASE_RATE = 4000.0;
+const int16_t SOUND_AMPLITUDE = 4096;
+
+// The sound from emulated time `time` (in 1 / SOUND_TICKS_PER_SECOND s) until the next edge
+struct SoundEdge{
+    uint64_t time;
+    bool on;
+    // XO-CHIP with a pattern loaded: play pattern at pitch instead of the buzzer
+    bool patterned;
+    uint8_t pitch;
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+};
+
+/*
+ * Turns the sound timer into samples on the audio thread. The emulation thread
+ * reports the machine's sound after every SOUND_SUBFRAMES-th of a frame (see
+ * Scheduler::RunFrame) and queues an edge, stamped with the emulated time, only
+ * when it changed; the audio callback replays the edges at their own sample,
+ * SOUND_LATENCY_FRAMES behind the newest emulated time. Neither side waits for
+ * the other. When emulation runs ahead of real time or stalls, playback jumps to
+ * the new target instead of building up a backlog or a gap, and since the
+ * waveform's phase carries on, the jump cannot be heard as a click.
+ */
+class Sound{
+    public:
+        Sound();
+
+        // emulation thread: `subframes` more of emulated time passed; queue an edge if the sound changed
+        void Advance(Chip8 const& chip8, unsigned int subframes = 1);
+
+        // audio thread: samples per second of Mix; call before the first Mix
+        void SetSampleRate(unsigned int rate);
+        // audio thread: write `count` signed 16-bit mono samples
+        void Mix(int16_t* samples, unsigned int count);
+
+        // read once both threads are stopped: edges played, times playback jumped, and
+        // edges that found the queue full and went out late
+        uint64_t Edges() const { return edges; }
+        uint64_t Resyncs() const { return resyncs; }
+        uint64_t Overflows() const { return overflows; }
+
+    private:
+        SpscQueue<SoundEdge, SOUND_QUEUE_SIZE> queue;
+        // emulated time reached by the emulation thread
+        std::atomic<uint64_t> now{0};
+
+        // emulation thread: time so far, the newest sound, and whether the queue had no room for it
+        uint64_t time{};
+        SoundEdge latest{};
+        bool unsent{};
+        uint64_t overflows{};
+
+        // audio thread: play position in 1 / (SOUND_TICKS_PER_SECOND * rate) s, so that
+        // a sample and an emulated tick are both a whole number of units
+        unsigned int rate{1};
+        uint64_t position{};
+        bool playing{};
+        // the edge being played; phase is a fraction of a buzzer period or of the whole pattern
+        SoundEdge current{};
+        uint32_t phase{};
+        uint32_t phaseStep{};
+        uint64_t edges{};
+        uint64_t resyncs{};
+
+        void Apply(SoundEdge const& edge);
+
+        Sound(Sound const&);
+        Sound& operator=(Sound const&);
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/*
+ * A fixed-size FIFO from one writer thread to one reader thread, without locks
+ * or waiting. Unlike TripleBuffer nothing is overwritten: every value pushed is
+ * popped in order, and Push fails instead when the reader has fallen CAPACITY
+ * values behind.
+ *
+ * head is only written by the reader and tail only by the writer; each side
+ * keeps a copy of the other's index and reloads it only when the copy says the
+ * queue is full (or empty), so most calls touch no shared cache line.
+ */
+template <typename T, size_t CAPACITY>
+class SpscQueue{
+    public:
+        SpscQueue(){}
+
+        // writer: append value; returns false (and drops nothing) if the queue is full
+        bool Push(T const& value){
+            size_t next = tail.load(std::memory_order_relaxed) + 1;
+            if (next - cachedHead > CAPACITY){
+                cachedHead = head.load(std::memory_order_acquire);
+                if (next - cachedHead > CAPACITY){
+                    return false;
+                }
+            }
+            slots[(next - 1) & INDEX_MASK] = value;
+            tail.store(next, std::memory_order_release);
+            return true;
+        }
+
+        // reader: the oldest value, or null if the queue is empty; stays valid until Pop()
+        T const* Peek(){
+            size_t current = head.load(std::memory_order_relaxed);
+            if (current == cachedTail){
+                cachedTail = tail.load(std::memory_order_acquire);
+                if (current == cachedTail){
+                    return nullptr;
+                }
+            }
+            return &slots[current & INDEX_MASK];
+        }
+        // reader: drop the value Peek() returned
+        void Pop(){
+            head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+    private:
+        static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+        static const size_t INDEX_MASK = CAPACITY - 1;
+
+        T slots[CAPACITY]{};
+        // writer and reader sides are on their own cache lines so they do not bounce;
+        // head and tail count values ever popped and pushed
+        alignas(64) std::atomic<size_t> tail{0};
+        size_t cachedHead{0};
+        alignas(64) std::atomic<size_t> head{0};
+        size_t cachedTail{0};
+
+        SpscQueue(SpscQueue const&);
+        SpscQueue& operator=(SpscQueue const&);
+};
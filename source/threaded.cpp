@@ -0,0 +1,308 @@
+#include "chip8.hpp"
+#include <cstring>
+
+/*
+ * Threaded-code engine. The whole interpreter loop is this one function: every
+ * handler ends by fetching the next predecoded instruction and jumping straight
+ * to that handler's label, so each opcode gets its own indirect branch instead
+ * of sharing the two calls of table -> sub-table dispatch. PC, I, SP and the
+ * registers live in locals and are written back to the object on exit.
+ *
+ * GCC and Clang support taking the address of a label (computed goto). Other
+ * compilers (or -DCHIP8_NO_COMPUTED_GOTO) get a switch inside a loop with the
+ * same handler bodies.
+ *
+ * Every handler must behave exactly like its OP_* counterpart in chip8.cpp.
+ */
+
+#if defined(__GNUC__) && !defined(CHIP8_NO_COMPUTED_GOTO)
+#define CHIP8_COMPUTED_GOTO 1
+#endif
+
+unsigned int Chip8::RunThreaded(unsigned int count){
+    uint16_t pcReg = pc;
+    uint16_t indexReg = index;
+    uint8_t spReg = sp;
+    uint8_t V[REGISTER_COUNT];
+    memcpy(V, registers, sizeof(V));
+
+    // pc wraps at the end of memory, which XO-CHIP makes 64 KB
+    uint16_t mask = memoryMask;
+
+    unsigned int executed = 0;
+    Instruction const* instruction;
+
+// fetch the next instruction, or leave once count instructions have run
+#define FETCH() \
+    if (executed == count){ \
+        goto done; \
+    } \
+    instruction = &decoded[pcReg & mask]; \
+    pcReg += 2; \
+    ++executed
+
+// a taken skip, over both halves of an XO-CHIP F000 nnnn (see Chip8::Skip)
+#define SKIP() \
+    pcReg += decoded[pcReg & mask].id == OPID_F000 ? 4 : 2
+
+#ifdef CHIP8_COMPUTED_GOTO
+    // must stay in OpId order
+    static void* const labels[OPID_COUNT] = {
+        &&L_NULL, &&L_00E0, &&L_00EE, &&L_1nnn, &&L_2nnn, &&L_3xkk, &&L_4xkk, &&L_5xy0,
+        &&L_6xkk, &&L_7xkk, &&L_8xy0, &&L_8xy1, &&L_8xy2, &&L_8xy3, &&L_8xy4, &&L_8xy5,
+        &&L_8xy6, &&L_8xy7, &&L_8xyE, &&L_9xy0, &&L_Annn, &&L_Bnnn, &&L_Cxkk, &&L_Dxyn,
+        &&L_Ex9E, &&L_ExA1, &&L_Fx07, &&L_Fx0A, &&L_Fx15, &&L_Fx18, &&L_Fx1E, &&L_Fx29,
+        &&L_Fx33, &&L_Fx55, &&L_Fx65,
+        &&L_00Cn, &&L_00FB, &&L_00FC, &&L_00FD, &&L_00FE, &&L_00FF, &&L_Fx30, &&L_Fx75,
+        &&L_Fx85, &&L_00Dn, &&L_5xy2, &&L_5xy3, &&L_F000, &&L_Fx01, &&L_F002, &&L_Fx3A
+    };
+#define HANDLER(op) L_##op
+#define NEXT() FETCH(); goto *labels[instruction->id]
+
+    NEXT();
+#else
+#define HANDLER(op) case OPID_##op
+#define NEXT() goto dispatch
+
+dispatch:
+    FETCH();
+    switch (instruction->id){
+#endif
+
+    HANDLER(NULL):
+        NEXT();
+
+    HANDLER(00E0):
+        ClearScreen();
+        NEXT();
+
+    HANDLER(00EE):
+        --spReg;
+        pcReg = stack[spReg & (STACK_LEVEL - 1)];
+        NEXT();
+
+    HANDLER(1nnn):
+        pcReg = instruction->nnn;
+        NEXT();
+
+    HANDLER(2nnn):
+        stack[spReg & (STACK_LEVEL - 1)] = pcReg;
+        ++spReg;
+        pcReg = instruction->nnn;
+        NEXT();
+
+    HANDLER(3xkk):
+        if (V[instruction->x] == instruction->kk){
+            SKIP();
+        }
+        NEXT();
+
+    HANDLER(4xkk):
+        if (V[instruction->x] != instruction->kk){
+            SKIP();
+        }
+        NEXT();
+
+    HANDLER(5xy0):
+        if (V[instruction->x] == V[instruction->y]){
+            SKIP();
+        }
+        NEXT();
+
+    HANDLER(6xkk):
+        V[instruction->x] = instruction->kk;
+        NEXT();
+
+    HANDLER(7xkk):
+        V[instruction->x] += instruction->kk;
+        NEXT();
+
+    HANDLER(8xy0):
+        V[instruction->x] = V[instruction->y];
+        NEXT();
+
+    HANDLER(8xy1):
+        V[instruction->x] |= V[instruction->y];
+        NEXT();
+
+    HANDLER(8xy2):
+        V[instruction->x] &= V[instruction->y];
+        NEXT();
+
+    HANDLER(8xy3):
+        V[instruction->x] ^= V[instruction->y];
+        NEXT();
+
+    HANDLER(8xy4):
+        {
+            unsigned int total = V[instruction->x] + V[instruction->y];
+            V[0xF] = total > 255u;
+            V[instruction->x] = total & 0xFFu;
+        }
+        NEXT();
+
+    HANDLER(8xy5):
+        // VF is written first, as in OP_8xy5, so x or y == F sees the new flag
+        V[0xF] = V[instruction->x] > V[instruction->y];
+        V[instruction->x] = V[instruction->x] - V[instruction->y];
+        NEXT();
+
+    HANDLER(8xy6):
+        V[0xF] = V[instruction->x] & 0x1u;
+        V[instruction->x] = V[instruction->x] >> 1u;
+        NEXT();
+
+    HANDLER(8xy7):
+        V[0xF] = V[instruction->x] < V[instruction->y];
+        V[instruction->x] = V[instruction->y] - V[instruction->x];
+        NEXT();
+
+    HANDLER(8xyE):
+        V[0xF] = (V[instruction->x] & 0x80u) >> 7u;
+        V[instruction->x] = V[instruction->x] << 1u;
+        NEXT();
+
+    HANDLER(9xy0):
+        if (V[instruction->x] != V[instruction->y]){
+            SKIP();
+        }
+        NEXT();
+
+    HANDLER(Annn):
+        indexReg = instruction->nnn;
+        NEXT();
+
+    HANDLER(Bnnn):
+        pcReg = instruction->nnn + V[0];
+        NEXT();
+
+    HANDLER(Cxkk):
+        V[instruction->x] = random.Byte() & instruction->kk;
+        NEXT();
+
+    HANDLER(Dxyn):
+        V[0xF] = DrawSprite(indexReg, V[instruction->x], V[instruction->y], instruction->n);
+        NEXT();
+
+    HANDLER(Ex9E):
+        if (V[instruction->x] < KEY_COUNT && keypad[V[instruction->x]]){
+            SKIP();
+        }
+        NEXT();
+
+    HANDLER(ExA1):
+        if (!(V[instruction->x] < KEY_COUNT && keypad[V[instruction->x]])){
+            SKIP();
+        }
+        NEXT();
+
+    HANDLER(Fx07):
+        V[instruction->x] = delayTimer;
+        NEXT();
+
+    HANDLER(Fx0A):
+        {
+            // lowest pressed key wins, like OP_Fx0A
+            unsigned int key = 0;
+            while (key < KEY_COUNT && !keypad[key]){
+                ++key;
+            }
+            if (key < KEY_COUNT){
+                V[instruction->x] = key;
+            }
+            else{
+                // the rest of the budget is spent waiting, as in Run()
+                pcReg -= 2;
+                keyWait = true;
+                executed = count;
+            }
+        }
+        NEXT();
+
+    HANDLER(Fx15):
+        delayTimer = V[instruction->x];
+        NEXT();
+
+    HANDLER(Fx18):
+        soundTimer = V[instruction->x];
+        NEXT();
+
+    HANDLER(Fx1E):
+        indexReg += V[instruction->x];
+        NEXT();
+
+    HANDLER(Fx29):
+        indexReg = FONTSET_START_ADDRESS + (5 * V[instruction->x]);
+        NEXT();
+
+    HANDLER(Fx33):
+        {
+            uint8_t num = V[instruction->x];
+            memory[(indexReg + 2) & memoryMask] = num % 10;
+            num /= 10;
+            memory[(indexReg + 1) & memoryMask] = num % 10;
+            num /= 10;
+            memory[indexReg & memoryMask] = num % 10;
+            Predecode(indexReg, 3);
+        }
+        NEXT();
+
+    HANDLER(Fx55):
+        for (unsigned int i = 0; i <= instruction->x; ++i){
+            memory[(indexReg + i) & memoryMask] = V[i];
+        }
+        Predecode(indexReg, instruction->x + 1);
+        NEXT();
+
+    HANDLER(Fx65):
+        for (unsigned int i = 0; i <= instruction->x; ++i){
+            V[i] = memory[(indexReg + i) & memoryMask];
+        }
+        NEXT();
+
+    // SCHIP and XO-CHIP opcodes are rare next to the ones above; they run through their
+    // OP_* handler with the machine state written back around the call
+    HANDLER(00Cn):
+    HANDLER(00FB):
+    HANDLER(00FC):
+    HANDLER(00FD):
+    HANDLER(00FE):
+    HANDLER(00FF):
+    HANDLER(Fx30):
+    HANDLER(Fx75):
+    HANDLER(Fx85):
+    HANDLER(00Dn):
+    HANDLER(5xy2):
+    HANDLER(5xy3):
+    HANDLER(F000):
+    HANDLER(Fx01):
+    HANDLER(F002):
+    HANDLER(Fx3A):
+        pc = pcReg;
+        index = indexReg;
+        sp = spReg;
+        memcpy(registers, V, sizeof(V));
+        ((*this).*(handlers[instruction->id]))(*instruction);
+        pcReg = pc;
+        indexReg = index;
+        spReg = sp;
+        memcpy(V, registers, sizeof(V));
+        NEXT();
+
+#ifndef CHIP8_COMPUTED_GOTO
+    }
+#endif
+
+#undef HANDLER
+#undef NEXT
+#undef SKIP
+#undef FETCH
+
+done:
+    pc = pcReg;
+    index = indexReg;
+    sp = spReg;
+    memcpy(registers, V, sizeof(V));
+
+    return executed;
+}
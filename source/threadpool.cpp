@@ -0,0 +1,110 @@
+#include "threadpool.hpp"
+
+// index of the pool worker running on this thread, or -1 outside the pool
+static thread_local int workerId = -1;
+// pool that worker belongs to, so a task of one pool submitting to another goes round-robin
+static thread_local ThreadPool const* workerPool = nullptr;
+
+ThreadPool::ThreadPool(unsigned int threads){
+    if (threads == 0){
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0){
+        threads = 1;
+    }
+
+    for (unsigned int i = 0; i < threads; ++i){
+        queues.emplace_back(new Queue());
+    }
+    for (unsigned int i = 0; i < threads; ++i){
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    Wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workReady.notify_all();
+    for (size_t i = 0; i < workers.size(); ++i){
+        workers[i].join();
+    }
+}
+
+void ThreadPool::Submit(Task task){
+    unsigned int id;
+    if (workerPool == this){
+        id = workerId;
+    }
+    else{
+        id = nextQueue++ % queues.size();
+    }
+
+    ++pending;
+    {
+        // counted before it is visible, so queued never drops below the real number of tasks;
+        // the pool lock orders this against a worker checking `queued` before sleeping
+        std::lock_guard<std::mutex> lock(mutex);
+        ++queued;
+        std::lock_guard<std::mutex> queueLock(queues[id]->mutex);
+        queues[id]->tasks.push_back(std::move(task));
+    }
+    workReady.notify_one();
+}
+
+void ThreadPool::Wait(){
+    std::unique_lock<std::mutex> lock(mutex);
+    allDone.wait(lock, [this]{ return pending == 0; });
+}
+
+bool ThreadPool::TakeTask(unsigned int id, Task& task){
+    // own deque, newest first
+    {
+        Queue& own = *queues[id];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()){
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // steal the oldest task of someone else, starting with the next worker
+    for (size_t i = 1; i < queues.size(); ++i){
+        Queue& victim = *queues[(id + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()){
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::WorkerLoop(unsigned int id){
+    workerId = id;
+    workerPool = this;
+
+    while (true){
+        Task task;
+        if (TakeTask(id, task)){
+            --queued;
+            task();
+
+            if (--pending == 0){
+                std::lock_guard<std::mutex> lock(mutex);
+                allDone.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        workReady.wait(lock, [this]{ return stopping || queued > 0; });
+        if (stopping && queued == 0){
+            return;
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed set of worker threads with one task deque each. A worker pops from the
+ * back of its own deque (newest first, still warm in cache) and, when that is
+ * empty, steals from the front of the others. Tasks submitted from inside a
+ * task go to the current worker's deque, so a job that reschedules itself keeps
+ * running on the same core unless someone else runs dry.
+ */
+class ThreadPool{
+    public:
+        typedef std::function<void()> Task;
+
+        // threads == 0 uses std::thread::hardware_concurrency()
+        explicit ThreadPool(unsigned int threads = 0);
+        ~ThreadPool();
+
+        // queue a task; from a worker it goes to that worker's deque, otherwise round-robin
+        void Submit(Task task);
+        // block until every submitted task (including ones they submitted) has finished
+        void Wait();
+
+        unsigned int Threads() const { return (unsigned int)workers.size(); }
+
+    private:
+        struct Queue{
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::thread> workers;
+        std::vector<std::unique_ptr<Queue>> queues;
+
+        // guards sleeping and waking; the deques have their own locks
+        std::mutex mutex;
+        // signalled when work is submitted or the pool shuts down
+        std::condition_variable workReady;
+        // signalled when pending drops to zero
+        std::condition_variable allDone;
+        // tasks submitted but not finished
+        std::atomic<size_t> pending{0};
+        // tasks sitting in some deque; lets idle workers sleep
+        std::atomic<size_t> queued{0};
+        // next deque for tasks submitted from outside the pool
+        std::atomic<unsigned int> nextQueue{0};
+        bool stopping{};
+
+        void WorkerLoop(unsigned int id);
+        // pop own back, then steal others' front; false if every deque is empty
+        bool TakeTask(unsigned int id, Task& task);
+
+        ThreadPool(ThreadPool const&);
+        ThreadPool& operator=(ThreadPool const&);
+};
@@ -0,0 +1,114 @@
+#include "trace.hpp"
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+
+Trace::Trace(size_t capacity){
+    size_t size = 1;
+    while (size < capacity){
+        size <<= 1;
+    }
+    records = new TraceRecord[size]();
+    mask = size - 1;
+}
+
+Trace::~Trace(){
+    delete[] records;
+}
+
+bool Trace::Dump(char const* filename) const{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){
+        return false;
+    }
+    Dump(fd);
+    close(fd);
+    return true;
+}
+
+// Appends value as lowercase hex without leading zeros (matches std::hex output)
+static char* AppendHex(char* out, unsigned int value){
+    char digits[8];
+    int n = 0;
+    do{
+        digits[n++] = "0123456789abcdef"[value & 0xFu];
+        value >>= 4u;
+    } while (value != 0);
+
+    while (n > 0){
+        *out++ = digits[--n];
+    }
+    return out;
+}
+
+static char* AppendString(char* out, char const* str){
+    while (*str){
+        *out++ = *str++;
+    }
+    return out;
+}
+
+void Trace::Dump(int fd) const{
+    // oldest record still in the buffer
+    uint64_t first = count > mask ? count - (mask + 1) : 0;
+
+    for (uint64_t i = first; i < count; ++i){
+        TraceRecord const& record = records[i & mask];
+        // one record is well under 256 characters
+        char line[256];
+        char* out = line;
+
+        out = AppendString(out, "executing ");
+        out = AppendHex(out, record.opcode);
+        out = AppendString(out, "\nPC: ");
+        out = AppendHex(out, record.pc);
+        out = AppendString(out, "\nV0: ");
+        for (unsigned int r = 0; r < REGISTER_COUNT; ++r){
+            if (r > 0){
+                *out++ = ' ';
+                *out++ = 'V';
+                out = AppendHex(out, r);
+                *out++ = ':';
+                *out++ = ' ';
+            }
+            out = AppendHex(out, record.registers[r]);
+        }
+        out = AppendString(out, "\nI: ");
+        out = AppendHex(out, record.index);
+        out = AppendString(out, " SP: ");
+        out = AppendHex(out, record.sp);
+        out = AppendString(out, " DT: ");
+        out = AppendHex(out, record.delayTimer);
+        *out++ = '\n';
+
+        if (write(fd, line, out - line) < 0){
+            return;
+        }
+    }
+}
+
+// Crash handler state. Only one trace can be armed at a time.
+static Trace const* crashTrace = nullptr;
+static char const* crashFilename = nullptr;
+
+static void CrashHandler(int sig){
+    int fd = open(crashFilename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0){
+        crashTrace->Dump(fd);
+        close(fd);
+    }
+    // restore the default action and let the signal kill the process as usual
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void Trace::DumpOnCrash(char const* filename) const{
+    crashTrace = this;
+    crashFilename = filename;
+
+    signal(SIGSEGV, CrashHandler);
+    signal(SIGBUS, CrashHandler);
+    signal(SIGFPE, CrashHandler);
+    signal(SIGILL, CrashHandler);
+    signal(SIGABRT, CrashHandler);
+}
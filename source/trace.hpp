@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "chip8.hpp"
+
+// One executed instruction. Fixed size so the ring buffer is a plain array.
+struct TraceRecord{
+    // address the instruction was fetched from
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t index;
+    uint8_t sp;
+    uint8_t delayTimer;
+    // register values after the instruction executed
+    uint8_t registers[REGISTER_COUNT];
+};
+
+/*
+ * Preallocated ring buffer of TraceRecords. Recording is a couple of stores
+ * and never allocates, so it is cheap enough to leave on while hunting a bug.
+ * Only the newest `capacity` records are kept.
+ */
+class Trace{
+    public:
+        // capacity is rounded up to a power of two
+        explicit Trace(size_t capacity);
+        ~Trace();
+
+        void Record(uint16_t pc, uint16_t opcode, uint16_t index, uint8_t sp, uint8_t delayTimer, uint8_t const* registers){
+            TraceRecord& record = records[count & mask];
+            record.pc = pc;
+            record.opcode = opcode;
+            record.index = index;
+            record.sp = sp;
+            record.delayTimer = delayTimer;
+            for (unsigned int i = 0; i < REGISTER_COUNT; ++i){
+                record.registers[i] = registers[i];
+            }
+            ++count;
+        }
+
+        // write the buffered records, oldest first, in the same text layout as debug/myoutput
+        bool Dump(char const* filename) const;
+        // same as above but only uses write(2), so it is safe to call from a signal handler
+        void Dump(int fd) const;
+
+        // dump this trace to filename if the process dies from SIGSEGV, SIGBUS, SIGFPE, SIGILL or SIGABRT
+        void DumpOnCrash(char const* filename) const;
+
+    private:
+        TraceRecord* records{};
+        size_t mask{};
+        // total records ever written; count & mask is the next slot
+        uint64_t count{};
+
+        Trace(Trace const&);
+        Trace& operator=(Trace const&);
+};
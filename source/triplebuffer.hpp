@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*
+ * Hands the newest value from one writer thread to one reader thread without
+ * locks or waiting. The writer fills Back() and publishes it; the reader picks
+ * up whatever was published last and keeps it as Front() until the next
+ * Acquire(). Values published while the reader was busy are overwritten, never
+ * queued, so a slow reader always sees the latest one and never holds the
+ * writer up.
+ *
+ * Three slots: the writer owns one, the reader owns one, and the third is
+ * swapped between them with a single atomic exchange.
+ */
+template <typename T>
+class TripleBuffer{
+    public:
+        TripleBuffer(){}
+
+        // writer: the slot to fill next; its old contents are stale
+        T& Back(){ return slots[back]; }
+        // writer: make Back() the newest value and get a fresh slot to fill
+        void Publish(){
+            back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+
+        // reader: take the newest value if one was published since the last call; returns false if not
+        bool Acquire(){
+            if ((middle.load(std::memory_order_relaxed) & FRESH) == 0){
+                return false;
+            }
+            front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+            return true;
+        }
+        // reader: the value taken by the last successful Acquire()
+        T const& Front() const { return slots[front]; }
+
+    private:
+        // set in middle when it holds a value the reader has not taken yet
+        static const uint8_t FRESH = 4;
+        static const uint8_t INDEX_MASK = 3;
+
+        T slots[3]{};
+        // writer and reader sides are on their own cache lines so they do not bounce
+        alignas(64) uint8_t back{0};
+        alignas(64) std::atomic<uint8_t> middle{1};
+        alignas(64) uint8_t front{2};
+
+        TripleBuffer(TripleBuffer const&);
+        TripleBuffer& operator=(TripleBuffer const&);
+};